@@ -9,290 +9,3035 @@
  (i.e. : 'node' is more appropriate since this applies to directories as well)
  an element can be retrieved with its hash code (32-char md5 digest)
  collisions are resolved with additional increment (.%02d)
+ element files are read and written through the store interface (see store.c)
+
+ Each element also has a unique number (id), which never changes.
+ An element file starts with the full name of the element, followed by a line holding its id
+ and the count of records in its relations block (ex.: '#12 140'), a line holding a Bloom filter
+ of the related ids (ex.: '%00a0...', in hex), and then the relations of the element.
+ The filter allows to add a new relation without looking for it first.
+
+ Each type of elements has a catalog (ex.: tags.cat) allowing to list elements without
+ opening their files. It holds one line per id: a state char (CAT_LIVE, CAT_TRASH or
+ CAT_GONE), the hash code of the element, a space, and its full name (ex.: '+0cc175b9c0f1b6a831c399e269772661 a').
+ Lines of elements that are gone are reduced to their state char.
+ Since most names share a long prefix with the name of the previous element (ex.: files of a
+ same directory), names are front-coded : only the chars that differ from the name of the
+ previous line are stored, along with the count of shared chars (see CAT_SHARED). Lines are
+ grouped by CAT_RESTART ids, and the first named line of a group holds a full name, so that
+ a line is decoded by reading its group only.
+ The catalog index (ex.: tags.idx) holds the offset of each line (as uint64_t), so that
+ the line of an id can be read directly.
+ Catalogs are updated along with element files, and (re)built from element files whenever
+ they are missing.
+ The collision directory (ex.: tags.map) is a hash table giving the id of an element from the hash
+ of its name, so that an element file is found (or known not to exist) without probing the
+ files of colliding names. It is rebuilt from the catalog whenever it is missing.
+ The name index (ex.: files.ord) lists the ids of the elements sorted by name, so that the
+ elements whose name starts with a given prefix (ex.: files of a directory) are found by binary
+ search. Elements added after it was built are read from the catalog, and it is rebuilt once
+ they are more than ORD_TAIL_MAX (or whenever it is missing).
+ The trash index (ex.: files.trs) lists the ids of the trashed elements, so that the trash is listed
+ without reading the catalog. Ids are appended as elements are trashed, and the ones that are no
+ longer trashed (recovered or purged elements) are dropped when the index is read or when cleaning.
+ The relations counts (ex.: tags.cnt) hold, for each id, the count of live elements related to the
+ element (as uint32_t), so that the size of a tag is known without reading its file. Counts are
+ updated along with relations (and when related elements are deleted or recovered), and computed
+ from element files whenever they are missing or do not match the catalog.
+
+ Relations of an element are stored as a block of fixed-size records sorted by id ('+0000000012'
+ or '-0000000012'), where a relation is found by binary search and updated in place.
+ Large blocks (REL_PACK_MIN records or more) are packed instead : each record is written as the
+ difference with the previous id (shifted left, lowest bit telling if relation was removed), as a
+ varint of 5 bits groups (see rel_pack), so that a block of dense ids takes about one char per
+ relation. The length of a packed block is then given as a third number on the id line
+ (ex.: '#12 4096 4120'). A packed block is never updated in place: changes go to the tail.
+ Packed records are split into segments of REL_SEGMENT records : the records line is followed by a
+ skip table (ELEM_SKIP line) giving, for each segment but the first, the id of the record that
+ precedes it and its position, and the position of the skip table is given as a fourth number on the
+ id line (ex.: '#12 4096 4120 4098'). A relation is then looked for by decoding a single segment, and
+ a short list is intersected with the relations of an element without decoding the other segments.
+ Relations that are not in the block yet are appended after it (tail), and the last line mentioning
+ an id gives the current state of the relation. Once the tail holds REL_TAIL_MAX lines, it is merged
+ into the block (see file_compact).
+ Operations relating many elements collect their changes in a batch, which is applied with a
+ single read and a single write of each element file (see batch_commit).
+ Deleting an element only moves its file to the trash and sets its state in the catalog (tombstone):
+ related elements are left untouched, relations to elements that are not live are ignored when
+ lists are resolved (see elem_resolve_list), and they are dropped once the related element is
+ gone for good, when cleaning (see type_clean). Recovering an element is then the reverse move.
+ Relation changes are logged in the journal of the command before being applied, so that a command
+ interrupted by a crash is completed by the next one (see elem_sync_journal). Element files are either
+ replaced at once (see store_write), or updated in place by fixed-size records: a relation line torn by
+ a crash is ignored, and a Bloom filter is updated before the relation it gets a bit for.
+ In databases having the 'lazy' inverse setting, relations of tags are the reference: changes of
+ the relations of files are appended to a journal (files.inv) instead of being written to their
+ files, and are applied all at once before relations of files are read (see elem_sync_inverse).
+ (in databases created by former versions, relation lines hold names instead of ids: such
+ databases have to be converted with 'migrate')
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <glob.h>
+#include <fnmatch.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xalloc.h"
+#include "env.h"
+#include "hash.h"
+#include "list.h"
+#include "store.h"
+#include "elem.h"
+
+/* ELEM_DIR is defined in env.c
+ Array holding the names of the sub-directories for database.
+*/
+extern const char* ELEM_DIR[];
+
+/* PATH_SEPARATOR is defined in env.c (separator of the directories in file names) */
+extern const char* PATH_SEPARATOR;
+
+/* trash flag is defined in main driver (tagger.c)
+Allows to restrict current operation to trashed elements only.
+*/
+extern int trash_flag;
+
+/* verbose flag and interrupt flag are defined in main driver (tagger.c)
+*/
+extern int verbose_flag;
+extern volatile sig_atomic_t interrupt_flag;
+
+
+
+/* Parse the header of an element file held by given buffer: full name of the element (first line),
+ then its id and the count of records in its relations block, optionally followed by the length
+ of the packed block and by the position of its skip table (second line, ex.: '#12 140'), then its
+ Bloom filter (third line).
+ Id, count, length and position are optional (they are set to 0 if file has none), filter is set to
+ NULL if file has none.
+ Returns a pointer to the first relation line.
+*/
+static char* head_parse(char* buf, unsigned int* id, size_t* block, char** filter, size_t* packed, size_t* skip) {
+    char* line = buf + strcspn(buf, "\n");
+    if(id) *id = 0;
+    if(block) *block = 0;
+    if(filter) *filter = NULL;
+    if(packed) *packed = 0;
+    if(skip) *skip = 0;
+    if(*line) ++line;
+    if(line[0] == ELEM_ID) {
+        char* end;
+        unsigned int n = strtoul(line+1, &end, 10);
+        if(id) *id = n;
+        if(*end == ' ') {
+            size_t count = strtoul(end+1, &end, 10);
+            if(block) *block = count;
+            if(*end == ' ') {
+                size_t len = strtoul(end+1, &end, 10);
+                if(packed) *packed = len;
+                if(skip && *end == ' ') *skip = strtoul(end+1, NULL, 10);
+            }
+        }
+        line += strcspn(line, "\n");
+        if(*line) ++line;
+    }
+    if(line[0] == ELEM_BLOOM) {
+        if(filter) *filter = line+1;
+        line += strcspn(line, "\n");
+        if(*line) ++line;
+    }
+    return line;
+}
+
+/* Compute the position of the k-th bit of an id in a Bloom filter of given size (power of 2).
+*/
+static size_t bloom_bit(unsigned int id, int k, size_t bits) {
+    uint32_t h1 = (uint32_t) id * 2654435761u;
+    uint32_t h2 = (((uint32_t) id ^ ((uint32_t) id >> 16)) * 0x85ebca6bu) | 1;
+    return (size_t) (h1 + (uint32_t) k * h2) & (bits-1);
+}
+
+/* Get the value of an hex digit of a Bloom filter.
+*/
+static int bloom_digit(char c) {
+    return (c >= 'a')?c-'a'+10:c-'0';
+}
+
+/* Tell if an id may be in a Bloom filter of given length (in hex digits).
+ Returns 0 if the id is certainly not in the filter.
+*/
+static int bloom_test(char* filter, size_t len, unsigned int id) {
+    for(int k = 0; k < BLOOM_HASHES; ++k) {
+        size_t bit = bloom_bit(id, k, len*4);
+        if(!(bloom_digit(filter[bit/4]) & (1 << (bit%4)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Add an id to a Bloom filter of given length (in hex digits).
+ Returns 1 if the filter has changed.
+*/
+static int bloom_add(char* filter, size_t len, unsigned int id) {
+    int changed = 0;
+    for(int k = 0; k < BLOOM_HASHES; ++k) {
+        size_t bit = bloom_bit(id, k, len*4);
+        int digit = bloom_digit(filter[bit/4]);
+        if(!(digit & (1 << (bit%4)))) {
+            filter[bit/4] = "0123456789abcdef"[digit | (1 << (bit%4))];
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* Obtain the length (in hex digits) of the Bloom filter of an element having given count of relations
+ (room is left for relations to come: filter is resized whenever the tail is merged into the block).
+*/
+static size_t bloom_size(size_t count) {
+    size_t bits = BLOOM_BITS_MIN;
+    while(bits < BLOOM_BITS_REL * (count + count/2) && bits < BLOOM_BITS_MAX) {
+        bits *= 2;
+    }
+    return bits/4;
+}
+
+/* Write a record of a packed block : value (difference with the previous id, shifted left, lowest bit
+ set if relation was removed) is written by groups of 5 bits, lowest group first; each group is written
+ with one of the last 32 chars of REL_PACK_DIGITS, excepted the last one (one of the 32 first chars).
+ Returns the count of chars written (at most 7).
+*/
+static size_t rel_pack(char* out, unsigned int delta, char state) {
+    uint64_t value = ((uint64_t) delta << 1) | (state == ELEM_REM);
+    size_t n = 0;
+    while(value >= 32) {
+        out[n++] = REL_PACK_DIGITS[32 + (value & 31)];
+        value >>= 5;
+    }
+    out[n++] = REL_PACK_DIGITS[value];
+    return n;
+}
+
+/* Get the value of a char of a packed block (-1 if char is not one of REL_PACK_DIGITS).
+*/
+static int rel_digit(char c) {
+    if(c >= 'A' && c <= 'Z') return c-'A';
+    if(c >= 'a' && c <= 'z') return c-'a'+26;
+    if(c >= '0' && c <= '9') return c-'0'+52;
+    if(c == '-') return 62;
+    if(c == '_') return 63;
+    return -1;
+}
+
+/* Read a record of a packed block (see rel_pack) : id is increased by the delta, and state is set.
+ Returns a pointer to the next record, or NULL if there is no valid record before end.
+*/
+static char* rel_unpack(char* ptr, char* end, unsigned int* id, char* state) {
+    uint64_t value = 0;
+    for(int shift = 0; ptr < end && shift < 40; shift += 5) {
+        int digit = rel_digit(*ptr++);
+        if(digit < 0) {
+            return NULL;
+        }
+        value |= (uint64_t) (digit & 31) << shift;
+        if(digit < 32) {
+            *id += (unsigned int) (value >> 1);
+            *state = (value & 1)?ELEM_REM:ELEM_ADD;
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+/* entry of the skip table of a packed block */
+typedef struct skip_entry {
+    unsigned int base;      // id of the record that precedes the segment (0 for the first one)
+    unsigned int offset;    // position of the segment in the packed block
+} SKIP_ENTRY;
+
+/* Write the skip table of a packed block : each entry is written as two records of a packed block
+ (see rel_pack), holding the differences with the base and the position of the previous segment.
+ Returns the count of chars written (line starts with ELEM_SKIP and ends with a new line char).
+*/
+static size_t skip_pack(char* out, SKIP_ENTRY* entries, size_t count) {
+    size_t n = 0;
+    out[n++] = ELEM_SKIP;
+    for(size_t i = 1; i < count; ++i) {
+        n += rel_pack(out+n, entries[i].base - entries[i-1].base, ELEM_ADD);
+        n += rel_pack(out+n, entries[i].offset - entries[i-1].offset, ELEM_ADD);
+    }
+    out[n++] = '\n';
+    return n;
+}
+
+/* Read the skip table of a packed block (line starting with ELEM_SKIP, ending at end), for a
+ records line of given length.
+ Returns an array of entries, starting with the first segment (NULL if table is malformed).
+ Count is set to the count of segments.
+ (returned array has to be freed by caller)
+*/
+static SKIP_ENTRY* skip_parse(char* line, char* end, size_t records_len, size_t* count) {
+    if(line >= end || line[0] != ELEM_SKIP) {
+        return NULL;
+    }
+    size_t size = 16;
+    SKIP_ENTRY* entries = xmalloc(sizeof(SKIP_ENTRY) * size);
+    entries[0].base = 0;
+    entries[0].offset = 0;
+    *count = 1;
+    unsigned int base = 0, offset = 0;
+    char state;
+    for(char* ptr = line+1; ptr < end; ) {
+        if(!(ptr = rel_unpack(ptr, end, &base, &state)) || !(ptr = rel_unpack(ptr, end, &offset, &state))
+           || offset < entries[*count-1].offset || offset > records_len) {
+            free(entries);
+            return NULL;
+        }
+        if(*count == size) {
+            size *= 2;
+            entries = xrealloc(entries, sizeof(SKIP_ENTRY) * size);
+        }
+        entries[*count].base = base;
+        entries[(*count)++].offset = offset;
+    }
+    return entries;
+}
+
+/* Find the segment that may hold the record of given id (i.e. last segment having a lower base).
+*/
+static size_t skip_find(SKIP_ENTRY* entries, size_t count, unsigned int id) {
+    size_t lo = 0, hi = count;
+    while(hi - lo > 1) {
+        size_t mid = (lo+hi)/2;
+        if(entries[mid].base < id) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Read the header of an element file: full name of the element (first line) and its id (second line).
+ Name and id are optional (id is set to 0 if file has none).
+ return values:
+  0 file does not exist
+  1 header has been read
+*/
+static int elem_head(char* file, char* name, unsigned int* id) {
+    char head[ELEM_NAME_MAX+32];
+    if(!store_head(file, head, sizeof(head))) {
+        return 0;
+    }
+    size_t len = strcspn(head, "\n");
+    if(name) {
+        if(len >= ELEM_NAME_MAX) len = ELEM_NAME_MAX-1;
+        memcpy(name, head, len);
+        name[len] = 0;
+    }
+    if(id) {
+        head_parse(head, id, NULL, NULL, NULL, NULL);
+    }
+    return 1;
+}
+
+/* Build the path of an element file from its hash id, according to given fan-out
+ (ex.: with 2 levels, files/ab/cd/abcdef0123456789... instead of files/abcdef0123456789...).
+*/
+static void elem_path(char* elem_file, int type, char* elem_id, int fanout) {
+    char* ptr = elem_file + sprintf(elem_file, "%s/", ELEM_DIR[type]);
+    for(int i = 0; i < fanout && elem_id[2*i] && elem_id[2*i+1]; ++i) {
+        ptr += sprintf(ptr, "%.2s/", elem_id+2*i);
+    }
+    strcpy(ptr, elem_id);
+}
+
+/* data shared with store_scan callbacks */
+struct scan_data {
+    int type;
+    int trash;
+    LIST* list;
+    FILE* stream;
+    int fanout;
+    char** names;           // names of the related elements, by id (see catalog_load)
+    unsigned int names_count;
+    char* states;           // states of the related elements, by id
+    uint32_t* counts;       // relations counts being computed, by id (see counter_build)
+    unsigned int counts_count;
+};
+
+/* Tells if a file (as received by a store_scan callback) holds a trashed element.
+*/
+static int is_trash(char* name) {
+    size_t len = strlen(name);
+    return (len > strlen(ELEM_TRASH) && strcmp(name+len-strlen(ELEM_TRASH), ELEM_TRASH) == 0);
+}
+
+/* Append a string to a growable buffer.
+*/
+static void buf_append(char** buf, size_t* len, size_t* size, char* str) {
+    size_t str_len = strlen(str);
+    if(*len + str_len + 1 > *size) {
+        *size = 2*(*len + str_len + 1);
+        *buf = xrealloc(*buf, *size);
+    }
+    memcpy(*buf + *len, str, str_len+1);
+    *len += str_len;
+}
+
+/* Obtain the name of the catalog of given type of elements (ex.: tags.cat),
+ or the name of its index (ex.: tags.idx).
+ (returned string has to be freed by caller)
+*/
+static char* catalog_file(int type, char* ext) {
+    char* cat_file = xmalloc(strlen(ELEM_DIR[type])+strlen(ext)+1);
+    sprintf(cat_file, "%s%s", ELEM_DIR[type], ext);
+    return cat_file;
+}
+
+/* Retrieve the hash code of an element from the path of its file
+ (i.e.: file name without sub-directories nor trash extension).
+ (returned string has to be freed by caller)
+*/
+static char* catalog_id(char* file) {
+    char* base = strrchr(file, '/');
+    char* id = xstrdup((base)?base+1:file);
+    if(is_trash(id)) {
+        id[strlen(id)-strlen(ELEM_TRASH)] = 0;
+    }
+    return id;
+}
+
+/* entry of a catalog being built */
+struct catalog_entry {
+    unsigned int id;
+    char state;
+    char* line;
+};
+
+/* data shared with catalog_scan */
+struct catalog_data {
+    int type;
+    struct catalog_entry* entries;
+    size_t count;
+    size_t size;
+};
+
+/* Collect the catalog line of the element held by a file.
+*/
+static int catalog_scan(char* name, void* data) {
+    struct catalog_data* cat = data;
+    char* elem_file = xmalloc(strlen(ELEM_DIR[cat->type])+strlen(name)+2);
+    sprintf(elem_file, "%s/%s", ELEM_DIR[cat->type], name);
+    char elem_name[ELEM_NAME_MAX];
+    unsigned int id;
+    // files without id are ignored (databases created by former versions)
+    if(elem_head(elem_file, elem_name, &id) && id) {
+        if(cat->count == cat->size) {
+            cat->size = (cat->size)?cat->size*2:256;
+            cat->entries = xrealloc(cat->entries, sizeof(struct catalog_entry) * cat->size);
+        }
+        char* hash_code = catalog_id(name);
+        struct catalog_entry* entry = &cat->entries[cat->count++];
+        entry->id = id;
+        entry->state = is_trash(name)?CAT_TRASH:CAT_LIVE;
+        entry->line = xmalloc(strlen(hash_code)+strlen(elem_name)+4);
+        sprintf(entry->line, "%c%s %s\n", entry->state, hash_code, elem_name);
+        free(hash_code);
+    }
+    free(elem_file);
+    return 1;
+}
+
+/* Compare two catalog entries by id (live elements first).
+*/
+static int catalog_cmp(const void* a, const void* b) {
+    const struct catalog_entry* entry1 = a;
+    const struct catalog_entry* entry2 = b;
+    if(entry1->id != entry2->id) {
+        return (entry1->id > entry2->id)?1:-1;
+    }
+    return (entry1->state == CAT_LIVE)?-1:(entry2->state == CAT_LIVE);
+}
+
+/* Front-code a catalog line (without its new line char) against the name of the previous line
+ of its group (which is then updated), and write the result into given buffer.
+*/
+static void catalog_encode(char* line, char* prev, char* out, size_t size) {
+    char* sep = strchr(line, ' ');
+    if(!sep) {
+        // line of an element that is gone
+        snprintf(out, size, "%s", line);
+        return;
+    }
+    char* name = sep+1;
+    size_t shared = 0;
+    while(prev[shared] && prev[shared] == name[shared]) ++shared;
+    if(shared >= CAT_SHARED_MIN) {
+        snprintf(out, size, "%.*s%c%zu %s", (int) (sep-line), line, CAT_SHARED, shared, name+shared);
+    }
+    else {
+        snprintf(out, size, "%s", line);
+    }
+    if(strlen(name) < ELEM_NAME_MAX) strcpy(prev, name);
+    else prev[0] = 0;
+}
+
+/* Expand a front-coded catalog line (without its new line char), using the name of the previous
+ line of its group (which is then updated), and write the result into given buffer.
+*/
+static void catalog_decode(char* line, char* prev, char* out, size_t size) {
+    char* sep = strchr(line, ' ');
+    char* shared = strchr(line, CAT_SHARED);
+    if(sep && shared && shared < sep) {
+        size_t count = strtoul(shared+1, NULL, 10);
+        size_t prev_len = strlen(prev);
+        if(count > prev_len) count = prev_len;
+        snprintf(out, size, "%.*s %.*s%s", (int) (shared-line), line, (int) count, prev, sep+1);
+    }
+    else {
+        snprintf(out, size, "%s", line);
+    }
+    char* name = strchr(out, ' ');
+    if(!name) return;
+    if(strlen(name+1) < ELEM_NAME_MAX) strcpy(prev, name+1);
+    else prev[0] = 0;
+}
+
+/* Write a catalog and its index from given lines (one per id, starting with id 1).
+ Names are front-coded (see catalog_encode).
+*/
+static int catalog_write(int type, char** lines, size_t count) {
+    char* buf = NULL;
+    size_t len = 0, size = 0;
+    uint64_t* offsets = xmalloc(sizeof(uint64_t) * (count+1));
+    char prev[ELEM_NAME_MAX] = "";
+    char line[ELEM_NAME_MAX+64], out[ELEM_NAME_MAX+64];
+    for(size_t i = 0; i < count; ++i) {
+        offsets[i] = len;
+        if(i % CAT_RESTART == 0) prev[0] = 0;
+        snprintf(line, sizeof(line), "%.*s", (int) strcspn(lines[i], "\n"), lines[i]);
+        catalog_encode(line, prev, out, sizeof(out));
+        buf_append(&buf, &len, &size, out);
+        buf_append(&buf, &len, &size, "\n");
+    }
+    char* cat_file = catalog_file(type, CAT_EXT);
+    char* idx_file = catalog_file(type, IDX_EXT);
+    int res = store_write(cat_file, (buf)?buf:"", len) && store_write(idx_file, (char*) offsets, sizeof(uint64_t) * count);
+    free(idx_file);
+    free(cat_file);
+    free(offsets);
+    free(buf);
+    return res;
+}
+
+/* Build the catalog of given type of elements (and its index) by reading all element files.
+*/
+static int catalog_build(int type) {
+    struct catalog_data cat = {type, NULL, 0, 0};
+    if(!store_scan((char*) ELEM_DIR[type], catalog_scan, &cat)) {
+        return 0;
+    }
+    if(cat.count) {
+        qsort(cat.entries, cat.count, sizeof(struct catalog_entry), catalog_cmp);
+    }
+    unsigned int count = (cat.count)?cat.entries[cat.count-1].id:0;
+    char** lines = xmalloc(sizeof(char*) * (count+1));
+    char gone[3] = {CAT_GONE, '\n', 0};
+    for(unsigned int i = 0; i < count; ++i) {
+        lines[i] = gone;
+    }
+    // on duplicate id, first entry (live element) wins
+    for(size_t i = cat.count; i > 0; --i) {
+        lines[cat.entries[i-1].id-1] = cat.entries[i-1].line;
+    }
+    int res = catalog_write(type, lines, count);
+    // collision directory and name index are rebuilt from the new catalog when needed
+    char* map_file = catalog_file(type, MAP_EXT);
+    store_remove(map_file);
+    free(map_file);
+    char* ord_file = catalog_file(type, ORD_EXT);
+    store_remove(ord_file);
+    free(ord_file);
+    char* trs_file = catalog_file(type, TRS_EXT);
+    store_remove(trs_file);
+    free(trs_file);
+    char* cnt_file = catalog_file(type, CNT_EXT);
+    store_remove(cnt_file);
+    free(cnt_file);
+    for(size_t i = 0; i < cat.count; ++i) {
+        free(cat.entries[i].line);
+    }
+    free(cat.entries);
+    free(lines);
+    return res;
+}
+
+/* Retrieve the offset of the catalog line of given id (-1 if there is no such id).
+*/
+static long catalog_offset(int type, unsigned int id) {
+    char* idx_file = catalog_file(type, IDX_EXT);
+    uint64_t offset;
+    long res = -1;
+    if(id && store_get(idx_file, (long) (id-1) * sizeof(uint64_t), (char*) &offset, sizeof(uint64_t)) == sizeof(uint64_t)) {
+        res = (long) offset;
+    }
+    free(idx_file);
+    return res;
+}
+
+/* Decode the catalog lines of the group of given id (see CAT_RESTART) that come before the line
+ of that id, so that prev holds the name that line is front-coded against.
+ If buf is given, the line of that id is decoded into it as well (new line char is removed).
+*/
+static int catalog_group(int type, unsigned int id, char* prev, char* buf, size_t size) {
+    prev[0] = 0;
+    if(!id) {
+        return 0;
+    }
+    unsigned int first = id - (id-1) % CAT_RESTART;
+    unsigned int count = id - first + ((buf)?1:0);
+    if(!count) {
+        return 1;
+    }
+    // lines of the group are read at once
+    long start = catalog_offset(type, first);
+    long last = (count > 1)?catalog_offset(type, first+count-1):start;
+    if(start < 0 || last < start) {
+        return 0;
+    }
+    long len = last - start + ELEM_NAME_MAX+64;
+    char* raw = xmalloc(len+1);
+    char* cat_file = catalog_file(type, CAT_EXT);
+    len = store_get(cat_file, start, raw, len);
+    free(cat_file);
+    int res = (len > 0);
+    if(res) {
+        raw[len] = 0;
+        char out[ELEM_NAME_MAX+64];
+        char* line = raw;
+        for(unsigned int i = 0; i < count; ++i) {
+            char* eol = strchr(line, '\n');
+            if(eol) *eol = 0;
+            else if(i+1 < count) {
+                res = 0;
+                break;
+            }
+            catalog_decode(line, prev, out, sizeof(out));
+            if(buf && i+1 == count) snprintf(buf, size, "%s", out);
+            if(eol) line = eol+1;
+        }
+    }
+    free(raw);
+    return res;
+}
+
+/* Read the catalog line of given id into a buffer (new line char is removed, name is expanded).
+*/
+static int catalog_line(int type, unsigned int id, char* buf, size_t size) {
+    char prev[ELEM_NAME_MAX];
+    return catalog_group(type, id, prev, buf, size);
+}
+
+/* Read the whole catalog of given type of elements (which is built first if missing), with its
+ names expanded (i.e.: one '<state><hash code> <name>' line per id).
+ (returned buffer has to be freed by caller)
+*/
+static char* catalog_read(int type, size_t* len) {
+    char* cat_file = catalog_file(type, CAT_EXT);
+    size_t raw_len = 0;
+    char* raw = store_read(cat_file, &raw_len);
+    if(raw == NULL && catalog_build(type)) {
+        raw = store_read(cat_file, &raw_len);
+    }
+    free(cat_file);
+    if(raw == NULL) {
+        return NULL;
+    }
+    size_t buf_len = 0, size = raw_len*2+1;
+    char* buf = xmalloc(size);
+    buf[0] = 0;
+    char prev[ELEM_NAME_MAX] = "";
+    char out[ELEM_NAME_MAX+64];
+    unsigned int id = 0;
+    for(char* line = raw; *line; ) {
+        char* eol = strchr(line, '\n');
+        if(eol) *eol = 0;
+        if(id++ % CAT_RESTART == 0) prev[0] = 0;
+        catalog_decode(line, prev, out, sizeof(out));
+        buf_append(&buf, &buf_len, &size, out);
+        buf_append(&buf, &buf_len, &size, "\n");
+        if(!eol) break;
+        line = eol+1;
+    }
+    free(raw);
+    if(len) *len = buf_len;
+    return buf;
+}
+
+/* slot of a collision directory (the first one holds the count of used slots and the capacity) */
+typedef struct map_slot {
+    uint32_t key;           // first 32 bits of the hash of the element name
+    uint32_t id;            // 0 if slot is empty
+} MAP_SLOT;
+
+/* Obtain the key of a hash code (ex.: '0cc175b9c0f1b6a831c399e269772661.01').
+*/
+static uint32_t map_key(char* hash_code) {
+    char key[9];
+    memcpy(key, hash_code, 8);
+    key[8] = 0;
+    return (uint32_t) strtoul(key, NULL, 16);
+}
+
+/* Build the collision directory of given type of elements from its catalog, with at least given capacity.
+*/
+static int map_build(int type, uint32_t capacity) {
+    char* buf = catalog_read(type, NULL);
+    if(buf == NULL) {
+        return 0;
+    }
+    // lines of the catalog by id (live and trashed elements only)
+    size_t count = 0, size = 256, used = 0;
+    char** lines = xzalloc(sizeof(char*) * size);
+    for(char* line = buf; *line; ) {
+        char* eol = strchr(line, '\n');
+        if(eol) *eol = 0;
+        if(++count == size) {
+            size *= 2;
+            lines = xrealloc(lines, sizeof(char*) * size);
+        }
+        lines[count] = (line[0] != CAT_GONE && strchr(line, ' '))?line:NULL;
+        if(lines[count]) ++used;
+        if(!eol) break;
+        line = eol+1;
+    }
+    if(capacity < MAP_SLOTS_MIN) capacity = MAP_SLOTS_MIN;
+    while(capacity < 2*used) capacity *= 2;
+    MAP_SLOT* slots = xzalloc(sizeof(MAP_SLOT) * (capacity+1));
+    uint32_t mask = capacity-1;
+    for(unsigned int id = 1; id <= count; ++id) {
+        if(!lines[id]) continue;
+        uint32_t key = map_key(lines[id]+1);
+        char* name = strchr(lines[id], ' ')+1;
+        for(uint32_t i = key & mask; ; i = (i+1) & mask) {
+            MAP_SLOT* slot = &slots[i+1];
+            if(!slot->id) {
+                ++slots[0].key;
+            }
+            else if(slot->key != key || strcmp(strchr(lines[slot->id], ' ')+1, name) != 0) {
+                continue;
+            }
+            // empty slot, or former element by that name (latest id wins)
+            slot->key = key;
+            slot->id = id;
+            break;
+        }
+    }
+    slots[0].id = capacity;
+    char* map_file = catalog_file(type, MAP_EXT);
+    int res = store_write(map_file, (char*) slots, sizeof(MAP_SLOT) * (capacity+1));
+    free(map_file);
+    free(slots);
+    free(lines);
+    free(buf);
+    return res;
+}
+
+/* Look for an element in the collision directory, using its name.
+ Hash code is set to the one of the element file (or to the one a new element by that name
+ would get), state to the state of the element in the catalog, and slot to the position of its
+ slot (or of the slot a new element by that name would get).
+ return values:
+ -1 error occured
+  0 there is no element by that name
+  1 element found (id is set)
+*/
+static int map_find(int type, char* name, char* hash_code, unsigned int* id, char* state, long* slot) {
+    char elem_hash[33];
+    strncpy(elem_hash, hash(name), 32);
+    elem_hash[32] = 0;
+    uint32_t key = map_key(elem_hash);
+    char* map_file = catalog_file(type, MAP_EXT);
+    MAP_SLOT head;
+    if(store_get(map_file, 0, (char*) &head, sizeof(MAP_SLOT)) != sizeof(MAP_SLOT)) {
+        if(!map_build(type, 0) || store_get(map_file, 0, (char*) &head, sizeof(MAP_SLOT)) != sizeof(MAP_SLOT)) {
+            free(map_file);
+            return -1;
+        }
+    }
+    uint32_t capacity = head.id, mask = capacity-1;
+    // collision increments already in use for the hash of the name
+    char used[100] = {0};
+    long free_slot = -1;
+    int res = 0;
+    MAP_SLOT slots[8];
+    uint32_t i = key & mask, n = 0, j = 0;
+    for(uint32_t visited = 0; visited < capacity; ++visited, i = (i+1) & mask) {
+        if(j == n) {
+            // read slots by chunks (without wrapping around)
+            n = (capacity-i < 8)?capacity-i:8;
+            j = 0;
+            if(store_get(map_file, (long) (i+1) * sizeof(MAP_SLOT), (char*) slots, n * sizeof(MAP_SLOT)) != (long) (n * sizeof(MAP_SLOT))) {
+                res = -1;
+                break;
+            }
+        }
+        MAP_SLOT* ptr = &slots[j++];
+        long pos = (long) (i+1) * sizeof(MAP_SLOT);
+        if(!ptr->id) {
+            // end of the probe sequence
+            if(free_slot < 0) free_slot = pos;
+            break;
+        }
+        if(ptr->key != key) continue;
+        char line[ELEM_NAME_MAX+64];
+        if(!catalog_line(type, ptr->id, line, sizeof(line))) {
+            res = -1;
+            break;
+        }
+        char* row_name = strchr(line, ' ');
+        if(line[0] == CAT_GONE || !row_name) {
+            // slot of an element that is gone : it can be reused
+            if(free_slot < 0) free_slot = pos;
+            continue;
+        }
+        *row_name++ = 0;
+        if(strncmp(line+1, elem_hash, 32) == 0) {
+            // same hash : increment is in use
+            int inc = (line[33] == '.')?atoi(line+34):0;
+            if(inc >= 0 && inc < 100) used[inc] = 1;
+        }
+        if(strcmp(row_name, name) == 0) {
+            strcpy(hash_code, line+1);
+            *id = ptr->id;
+            if(state) *state = line[0];
+            if(slot) *slot = pos;
+            res = 1;
+            break;
+        }
+    }
+    if(res == 0) {
+        // first free increment
+        int inc = 0;
+        while(inc < 99 && used[inc]) ++inc;
+        if(inc) sprintf(hash_code, "%s.%02d", elem_hash, inc);
+        else strcpy(hash_code, elem_hash);
+        *id = 0;
+        if(slot) *slot = free_slot;
+    }
+    free(map_file);
+    return res;
+}
+
+/* Record the id of an element in the collision directory (the catalog line of the element must exist).
+*/
+static int map_add(int type, char* name, unsigned int id) {
+    char hash_code[ELEM_NAME_MAX];
+    unsigned int found_id;
+    long slot;
+    if(map_find(type, name, hash_code, &found_id, NULL, &slot) < 0) {
+        return 0;
+    }
+    char* map_file = catalog_file(type, MAP_EXT);
+    MAP_SLOT head, old;
+    int res = (store_get(map_file, 0, (char*) &head, sizeof(MAP_SLOT)) == sizeof(MAP_SLOT));
+    if(res && slot < 0) {
+        // no room left
+        res = map_build(type, head.id*2);
+    }
+    else if(res) {
+        MAP_SLOT new = {map_key(hash_code), id};
+        res = store_get(map_file, slot, (char*) &old, sizeof(MAP_SLOT)) == sizeof(MAP_SLOT)
+           && store_patch(map_file, slot, (char*) &new, sizeof(MAP_SLOT));
+        if(res && !old.id) {
+            ++head.key;
+            res = store_patch(map_file, 0, (char*) &head, sizeof(MAP_SLOT));
+            // keep load factor under 70%
+            if(res && head.key * 10 > head.id * 7) {
+                res = map_build(type, head.id*2);
+            }
+        }
+    }
+    free(map_file);
+    return res;
+}
+
+/* entry of a name index being built */
+struct ord_entry {
+    char* name;
+    uint32_t id;
+};
+
+/* Compare two entries of a name index by name, then by id.
+*/
+static int ord_cmp(const void* a, const void* b) {
+    const struct ord_entry* entry1 = a;
+    const struct ord_entry* entry2 = b;
+    int res = strcmp(entry1->name, entry2->name);
+    if(res) return res;
+    return (entry1->id < entry2->id)?-1:1;
+}
+
+/* Build the name index of given type of elements from its catalog.
+*/
+static int ord_build(int type) {
+    char* buf = catalog_read(type, NULL);
+    if(buf == NULL) {
+        return 0;
+    }
+    // live and trashed elements, with their names
+    size_t count = 0, size = 256;
+    uint32_t covered = 0;
+    struct ord_entry* entries = xmalloc(sizeof(struct ord_entry) * size);
+    for(char* line = buf; *line; ) {
+        char* eol = strchr(line, '\n');
+        if(eol) *eol = 0;
+        char* name = strchr(line, ' ');
+        ++covered;
+        if(line[0] != CAT_GONE && name) {
+            if(count == size) {
+                size *= 2;
+                entries = xrealloc(entries, sizeof(struct ord_entry) * size);
+            }
+            entries[count].name = name+1;
+            entries[count++].id = covered;
+        }
+        if(!eol) break;
+        line = eol+1;
+    }
+    qsort(entries, count, sizeof(struct ord_entry), ord_cmp);
+    uint32_t* ids = xmalloc(sizeof(uint32_t) * (count+2));
+    ids[0] = covered;
+    ids[1] = count;
+    for(size_t i = 0; i < count; ++i) {
+        ids[i+2] = entries[i].id;
+    }
+    char* ord_file = catalog_file(type, ORD_EXT);
+    int res = store_write(ord_file, (char*) ids, sizeof(uint32_t) * (count+2));
+    free(ord_file);
+    free(ids);
+    free(entries);
+    free(buf);
+    return res;
+}
+
+/* Read the name of an element from the catalog (name is empty for elements that are gone).
+*/
+static int ord_name(int type, uint32_t id, char* state, char* name) {
+    char line[ELEM_NAME_MAX+64];
+    name[0] = 0;
+    if(!catalog_line(type, id, line, sizeof(line))) {
+        return 0;
+    }
+    char* ptr = strchr(line, ' ');
+    *state = line[0];
+    if(line[0] != CAT_GONE && ptr) {
+        snprintf(name, ELEM_NAME_MAX, "%s", ptr+1);
+    }
+    return 1;
+}
+
+/* elements found by ord_range */
+struct ord_found {
+    struct ord_entry* entries;
+    size_t count;
+    size_t size;
+};
+
+/* Record an element found by ord_range.
+*/
+static void ord_add(struct ord_found* found, uint32_t id, char* name) {
+    if(found->count == found->size) {
+        found->size = (found->size)?found->size*2:64;
+        found->entries = xrealloc(found->entries, sizeof(struct ord_entry) * found->size);
+    }
+    found->entries[found->count].name = xstrdup(name);
+    found->entries[found->count++].id = id;
+}
+
+/* Compare two entries of a name index by id.
+*/
+static int ord_id_cmp(const void* a, const void* b) {
+    const struct ord_entry* entry1 = a;
+    const struct ord_entry* entry2 = b;
+    if(entry1->id != entry2->id) return (entry1->id < entry2->id)?-1:1;
+    return 0;
+}
+
+/* Find the first entry of a name index, from given position, that holds an element that is not gone
+ (state and name are set to the ones of the element). Returns end if there is none.
+*/
+static uint32_t ord_probe(int type, uint32_t* ids, uint32_t i, uint32_t end, char* state, char* name) {
+    for(; i < end; ++i) {
+        if(ord_name(type, ids[i+2], state, name) && name[0]) break;
+    }
+    return i;
+}
+
+/* Find the first of given count of entries of a name index whose name is not lower than given prefix
+ (elements that are gone have no name anymore : they are skipped).
+*/
+static uint32_t ord_search(int type, uint32_t* ids, uint32_t count, char* prefix, size_t prefix_len) {
+    char name[ELEM_NAME_MAX], elem_state;
+    uint32_t low = 0, high = count;
+    while(low < high) {
+        uint32_t mid = low + (high-low)/2;
+        uint32_t i = ord_probe(type, ids, mid, high, &elem_state, name);
+        if(i < high && strncmp(name, prefix, prefix_len) < 0) low = i+1;
+        else high = mid;
+    }
+    return low;
+}
+
+/* Populate a list with nodes holding ids and names of the elements of given type and state (any state
+ if 0) whose name starts with given prefix, using the name index (which is built first if missing, or rebuilt if too many
+ elements were added since it was built).
+ Elements listed in the index are sorted by name, so that the ones having given prefix are found by
+ binary search and read in a row; elements added since then are checked one by one.
+ Found elements are sorted by id before being appended, so that the list is filled in a single pass.
+*/
+static int ord_range(int type, char* prefix, size_t prefix_len, char state, LIST* list) {
+    char* ord_file = catalog_file(type, ORD_EXT);
+    char* idx_file = catalog_file(type, IDX_EXT);
+    long idx_size = store_size(idx_file);
+    uint32_t max_id = (idx_size > 0)?idx_size / sizeof(uint64_t):0;
+    free(idx_file);
+    size_t len = 0;
+    uint32_t* ids = NULL;
+    for(int pass = 0; pass < 2 && !ids; ++pass) {
+        if(pass && !ord_build(type)) break;
+        ids = (uint32_t*) store_map(ord_file, &len);
+        if(ids && (len < 2*sizeof(uint32_t) || len != sizeof(uint32_t) * (ids[1]+2)
+                   || ids[0] > max_id || (!pass && max_id - ids[0] > ORD_TAIL_MAX))) {
+            // malformed or outdated index
+            store_unmap((char*) ids, len);
+            ids = NULL;
+        }
+    }
+    free(ord_file);
+    if(!ids) {
+        return 0;
+    }
+    char name[ELEM_NAME_MAX], elem_state;
+    uint32_t covered = ids[0], count = ids[1];
+    uint32_t low = ord_search(type, ids, count, prefix, prefix_len);
+    struct ord_found found = {NULL, 0, 0};
+    for(uint32_t i = ord_probe(type, ids, low, count, &elem_state, name); i < count;
+        i = ord_probe(type, ids, i+1, count, &elem_state, name)) {
+        if(strncmp(name, prefix, prefix_len) != 0) break;
+        if(!state || elem_state == state) ord_add(&found, ids[i+2], name);
+    }
+    // elements added after the index was built
+    for(uint32_t id = covered+1; id <= max_id; ++id) {
+        if(ord_name(type, id, &elem_state, name) && (!state || elem_state == state) && strncmp(name, prefix, prefix_len) == 0) {
+            ord_add(&found, id, name);
+        }
+    }
+    store_unmap((char*) ids, len);
+    qsort(found.entries, found.count, sizeof(struct ord_entry), ord_id_cmp);
+    for(size_t i = 0; i < found.count; ++i) {
+        list_append(list, found.entries[i].id, found.entries[i].name);
+    }
+    free(found.entries);
+    return 1;
+}
+
+/* Update the name index of given type of elements once some elements were renamed, their new names
+ all starting with given prefix (see type_move). Renamed elements are taken out of the index, then merged
+ back (sorted by name) into the range of entries whose name starts with that prefix : only the names of
+ that range are read. An index that does not match the catalog is dropped (it is rebuilt when needed).
+*/
+static int ord_rename(int type, char* prefix, struct ord_entry* renamed, size_t renamed_count) {
+    char* ord_file = catalog_file(type, ORD_EXT);
+    char* idx_file = catalog_file(type, IDX_EXT);
+    long idx_size = store_size(idx_file);
+    uint32_t max_id = (idx_size > 0)?idx_size / sizeof(uint64_t):0;
+    free(idx_file);
+    size_t len = 0;
+    uint32_t* ids = (renamed_count)?(uint32_t*) store_read(ord_file, &len):NULL;
+    if(!ids) {
+        free(ord_file);
+        return 1;
+    }
+    if(len < 2*sizeof(uint32_t) || len != sizeof(uint32_t) * (ids[1]+2) || ids[0] > max_id) {
+        free(ids);
+        int res = store_remove(ord_file);
+        free(ord_file);
+        return res;
+    }
+    uint32_t covered = ids[0], count = ids[1];
+    // renamed elements listed in the index (others are checked one by one by ord_range)
+    struct ord_entry* entries = xmalloc(sizeof(struct ord_entry) * renamed_count);
+    size_t entries_count = 0;
+    for(size_t i = 0; i < renamed_count; ++i) {
+        if(renamed[i].id <= covered) entries[entries_count++] = renamed[i];
+    }
+    qsort(entries, entries_count, sizeof(struct ord_entry), ord_id_cmp);
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < count; ++i) {
+        struct ord_entry key = {NULL, ids[i+2]};
+        if(!bsearch(&key, entries, entries_count, sizeof(struct ord_entry), ord_id_cmp)) {
+            ids[2+kept++] = ids[i+2];
+        }
+    }
+    qsort(entries, entries_count, sizeof(struct ord_entry), ord_cmp);
+    // range of the remaining entries whose name starts with the prefix
+    size_t prefix_len = strlen(prefix);
+    uint32_t low = ord_search(type, ids, kept, prefix, prefix_len), high = low;
+    char name[ELEM_NAME_MAX], elem_state;
+    uint32_t* out = xmalloc(sizeof(uint32_t) * (count+2));
+    out[0] = covered;
+    out[1] = count;
+    memcpy(out+2, ids+2, sizeof(uint32_t) * low);
+    size_t n = low+2, j = 0;
+    for(; high < kept; ++high) {
+        if(!ord_name(type, ids[high+2], &elem_state, name)) break;
+        if(name[0]) {
+            if(strncmp(name, prefix, prefix_len) != 0) break;
+            struct ord_entry entry = {name, ids[high+2]};
+            while(j < entries_count && ord_cmp(&entries[j], &entry) < 0) out[n++] = entries[j++].id;
+        }
+        // entries of elements that are gone stay where they are
+        out[n++] = ids[high+2];
+    }
+    while(j < entries_count) out[n++] = entries[j++].id;
+    memcpy(out+n, ids+2+high, sizeof(uint32_t) * (kept-high));
+    n += kept-high;
+    int res = (n == count+2)?store_write(ord_file, (char*) out, sizeof(uint32_t) * n):store_remove(ord_file);
+    free(out);
+    free(entries);
+    free(ids);
+    free(ord_file);
+    return res;
+}
+
+/* change of the relations count of an element */
+typedef struct count_change {
+    unsigned int id;
+    int delta;
+} COUNT_CHANGE;
+
+/* Give a null relations count to a new element (counts that do not match the catalog are dropped).
+*/
+static int counter_extend(int type, unsigned int id) {
+    char* cnt_file = catalog_file(type, CNT_EXT);
+    long size = store_size(cnt_file);
+    int res = 1;
+    if(size >= 0) {
+        uint32_t count = 0;
+        res = (size == (long) ((id-1) * sizeof(uint32_t)))?store_append(cnt_file, (char*) &count, sizeof(uint32_t))
+                                                        :store_remove(cnt_file);
+    }
+    free(cnt_file);
+    return res;
+}
+
+/* Apply changes to the relations counts of elements of given type (nothing is done if counts are
+ missing : they are computed when read).
+ A few counts are patched in place, otherwise the whole file is rewritten. If a count cannot be
+ updated consistently, counts are dropped (so that they are computed again).
+*/
+static int counter_update(int type, COUNT_CHANGE* changes, size_t count) {
+    char* cnt_file = catalog_file(type, CNT_EXT);
+    int res = 1;
+    if(count && store_exists(cnt_file)) {
+        int valid = 1;
+        if(count <= CNT_PATCH_MAX) {
+            for(size_t i = 0; i < count && valid && res; ++i) {
+                long pos = (long) (changes[i].id-1) * sizeof(uint32_t);
+                uint32_t value;
+                valid = changes[i].id && store_get(cnt_file, pos, (char*) &value, sizeof(uint32_t)) == sizeof(uint32_t)
+                        && (long) value + changes[i].delta >= 0;
+                if(valid) {
+                    value += changes[i].delta;
+                    res = store_patch(cnt_file, pos, (char*) &value, sizeof(uint32_t));
+                }
+            }
+        }
+        else {
+            size_t len;
+            uint32_t* values = (uint32_t*) store_read(cnt_file, &len);
+            valid = (values != NULL);
+            for(size_t i = 0; i < count && valid; ++i) {
+                unsigned int id = changes[i].id;
+                valid = id && id <= len / sizeof(uint32_t) && (long) values[id-1] + changes[i].delta >= 0;
+                if(valid) values[id-1] += changes[i].delta;
+            }
+            if(valid) res = store_write(cnt_file, (char*) values, len);
+            free(values);
+        }
+        if(!valid) res = store_remove(cnt_file);
+    }
+    free(cnt_file);
+    return res;
+}
+
+/* Add an element to the catalog.
+ Returns the id given to the element (0 on error).
+*/
+static unsigned int catalog_add(ELEM* elem) {
+    char* cat_file = catalog_file(elem->type, CAT_EXT);
+    char* idx_file = catalog_file(elem->type, IDX_EXT);
+    unsigned int id = 0;
+    if(store_exists(cat_file) || catalog_build(elem->type)) {
+        long offset = store_size(cat_file);
+        long idx_size = store_size(idx_file);
+        if(offset < 0) offset = 0;
+        if(idx_size < 0) idx_size = 0;
+        uint64_t line_offset = offset;
+        unsigned int new_id = idx_size / sizeof(uint64_t) + 1;
+        // name is front-coded against the name of the previous line of the group
+        char prev[ELEM_NAME_MAX];
+        if(catalog_group(elem->type, new_id, prev, NULL, 0)) {
+            char* hash_code = catalog_id(elem->file);
+            char* line = xmalloc(strlen(hash_code)+strlen(elem->name)+4);
+            sprintf(line, "%c%s %s", CAT_LIVE, hash_code, elem->name);
+            char* out = xmalloc(strlen(line)+32);
+            catalog_encode(line, prev, out, strlen(line)+32);
+            strcat(out, "\n");
+            if(store_append(cat_file, out, strlen(out)) && store_append(idx_file, (char*) &line_offset, sizeof(uint64_t))) {
+                id = new_id;
+                if(!map_add(elem->type, elem->name, id) || !counter_extend(elem->type, id)) id = 0;
+            }
+            free(out);
+            free(line);
+            free(hash_code);
+        }
+    }
+    free(idx_file);
+    free(cat_file);
+    return id;
+}
+
+/* Change the state of the catalog line of given id, if it has given state.
+*/
+static int catalog_update(int type, unsigned int id, char from, char to) {
+    char* cat_file = catalog_file(type, CAT_EXT);
+    int res = 1;
+    if(!store_exists(cat_file)) {
+        // catalog is built from element files, which are already up to date
+        res = catalog_build(type);
+    }
+    else {
+        long offset = catalog_offset(type, id);
+        char state;
+        if(offset < 0 || store_get(cat_file, offset, &state, 1) != 1) {
+            res = 0;
+        }
+        else if(state == from) {
+            res = store_patch(cat_file, offset, &to, 1);
+        }
+    }
+    free(cat_file);
+    return res;
+}
+
+/* Load the names of all the elements of given type listed in the catalog (whatever their state).
+ Returns an array of names by id (names[0] is unused), count is set to the highest id.
+ If states is given, it is set to an array holding the state of each element, by id.
+ (returned arrays and strings have to be freed by caller)
+*/
+static char** catalog_load(int type, unsigned int* count, char** states) {
+    char* buf = catalog_read(type, NULL);
+    *count = 0;
+    if(buf == NULL) {
+        return NULL;
+    }
+    size_t size = 256;
+    char** names = xzalloc(sizeof(char*) * size);
+    if(states) *states = xzalloc(size);
+    for(char* line = buf; *line; ) {
+        char* eol = strchr(line, '\n');
+        if(eol) *eol = 0;
+        if(++(*count) == size) {
+            size *= 2;
+            names = xrealloc(names, sizeof(char*) * size);
+            if(states) *states = xrealloc(*states, size);
+        }
+        char* name = strchr(line, ' ');
+        names[*count] = (name)?xstrdup(name+1):NULL;
+        if(states) (*states)[*count] = line[0];
+        if(!eol) break;
+        line = eol+1;
+    }
+    free(buf);
+    return names;
+}
+
+/* Release an array of names obtained with catalog_load.
+*/
+static void catalog_free(char** names, unsigned int count) {
+    if(names) {
+        for(unsigned int i = 1; i <= count; ++i) {
+            free(names[i]);
+        }
+        free(names);
+    }
+}
+
+/* Build the trash index of given type of elements from its catalog.
+*/
+static int trash_build(int type) {
+    char* buf = catalog_read(type, NULL);
+    if(buf == NULL) {
+        return 0;
+    }
+    size_t count = 0, size = 256;
+    uint32_t* ids = xmalloc(sizeof(uint32_t) * size);
+    uint32_t id = 0;
+    for(char* line = buf; *line; ) {
+        char* eol = strchr(line, '\n');
+        ++id;
+        if(line[0] == CAT_TRASH) {
+            if(count == size) {
+                size *= 2;
+                ids = xrealloc(ids, sizeof(uint32_t) * size);
+            }
+            ids[count++] = id;
+        }
+        if(!eol) break;
+        line = eol+1;
+    }
+    char* trs_file = catalog_file(type, TRS_EXT);
+    int res = store_write(trs_file, (char*) ids, sizeof(uint32_t) * count);
+    free(trs_file);
+    free(ids);
+    free(buf);
+    return res;
+}
+
+/* Add the id of a trashed element to the trash index (which is built if missing).
+*/
+static int trash_add(int type, unsigned int id) {
+    char* trs_file = catalog_file(type, TRS_EXT);
+    int res;
+    if(store_exists(trs_file)) {
+        uint32_t trs_id = id;
+        res = store_append(trs_file, (char*) &trs_id, sizeof(uint32_t));
+    }
+    else {
+        // catalog already holds the element as trashed
+        res = trash_build(type);
+    }
+    free(trs_file);
+    return res;
+}
+
+/* Compare two ids of a trash index.
+*/
+static int trash_cmp(const void* a, const void* b) {
+    uint32_t id1 = *(const uint32_t*) a;
+    uint32_t id2 = *(const uint32_t*) b;
+    return (id1 > id2) - (id1 < id2);
+}
+
+/* Populate a list with nodes holding ids and names of the trashed elements of given type, as listed
+ by the trash index (only the catalog lines of these elements are read).
+ Ids that are no longer trashed are skipped, and the index is rewritten without them.
+*/
+static int trash_retrieve_list(int type, LIST* list) {
+    char* trs_file = catalog_file(type, TRS_EXT);
+    size_t len = 0;
+    uint32_t* ids = (uint32_t*) store_read(trs_file, &len);
+    if(ids == NULL && trash_build(type)) {
+        ids = (uint32_t*) store_read(trs_file, &len);
+    }
+    if(ids == NULL) {
+        free(trs_file);
+        return 0;
+    }
+    size_t count = len / sizeof(uint32_t), kept = 0;
+    qsort(ids, count, sizeof(uint32_t), trash_cmp);
+    // ids come sorted : each node is appended after the previous one
+    char line[ELEM_NAME_MAX+64];
+    for(size_t i = 0; i < count; ++i) {
+        char* name;
+        if(kept && ids[kept-1] == ids[i]) continue;
+        if(!catalog_line(type, ids[i], line, sizeof(line)) || line[0] != CAT_TRASH || !(name = strchr(line, ' '))) continue;
+        ids[kept++] = ids[i];
+        list_append(list, ids[i], xstrdup(name+1));
+    }
+    int res = (kept == count) || store_write(trs_file, (char*) ids, sizeof(uint32_t) * kept);
+    free(ids);
+    free(trs_file);
+    return res;
+}
+
+/* Find the hashed filename (path relative to install dir) associated to an element (tag or file).
+ In case of collision, name is resolved by adding an extension with an increment
+ (the collision directory gives the file of an existing element, or the first free increment).
+ (this function do not create new file and always returns a filename)
+*/
+char* resolve_name(int type, char* name) {
+    char hash_code[ELEM_NAME_MAX];
+    unsigned int id;
+    if(map_find(type, name, hash_code, &id, NULL, NULL) < 0) {
+        strcpy(hash_code, hash(name));
+    }
+    // we add 3 chars for each fan-out sub-directory, and 1 char for slash
+    char* elem_file = xmalloc(strlen(ELEM_DIR[type])+strlen(hash_code)+3*FANOUT_MAX+1+1);
+    elem_path(elem_file, type, hash_code, db_config.fanout);
+    return elem_file;
+}
+
+/* Retrieve an element using its name as stored in the database.
+ return values:
+ -1 error occured
+  0 element does not exist and was not created
+  1 element already exists (and was not created)
+  2 element was created  
+*/
+int elem_open(int type, char* name, ELEM* el, int flag_create) {
+    el->type = type;
+    el->name = xmalloc(strlen(name)+1);
+    strcpy(el->name, name);
+    // look for the element in the collision directory (no element file is opened)
+    char hash_code[ELEM_NAME_MAX];
+    char state = 0;
+    int found = map_find(type, el->name, hash_code, &el->id, &state, NULL);
+    if(found < 0) {
+        strcpy(hash_code, hash(el->name));
+    }
+    // we add 3 chars for each fan-out sub-directory, and 1 char for slash
+    el->file = xmalloc(strlen(ELEM_DIR[type])+strlen(hash_code)+3*FANOUT_MAX+1+1);
+    elem_path(el->file, type, hash_code, db_config.fanout);
+    if(found < 0) {
+        return -1;
+    }
+    if(found && state == CAT_LIVE) {
+        // element exists and we assume its file is consistent (i.e.: full name as first line, then id)
+        return 1;
+    }
+    el->id = 0;
+    if(flag_create) {
+        // file does not exist yet : add a first line containing the full name of the element, a line with its id,
+        // and an empty Bloom filter
+        if(!(el->id = catalog_add(el))) {
+            return -1;
+        }
+        char filter[BLOOM_BITS_MIN/4+1];
+        memset(filter, '0', BLOOM_BITS_MIN/4);
+        filter[BLOOM_BITS_MIN/4] = 0;
+        char* line = xmalloc(strlen(el->name)+strlen(filter)+32);
+        sprintf(line, "%s\n%c%u 0\n%c%s\n", el->name, ELEM_ID, el->id, ELEM_BLOOM, filter);
+        int res = store_write(el->file, line, strlen(line));
+        free(line);
+        if(!res) {
+            // error at file creation
+            return -1;
+        }
+        return 2;
+    }
+    return 0;
+}
+
+/* Retrieve an element using a name given by user
+ (filenames are converted according to the DB node syntax).
+ Return values are the same as for elem_open.
+*/
+int elem_init(int type, char* name, ELEM* el, int flag_create) {
+    ELEM temp;
+    if(el == NULL) {
+        el = &temp;
+    }
+    if(type == ELEM_FILE){
+        if( !(name = get_path(name)) ) {
+            return -1;
+        }        
+    }        
+    return elem_open(type, name, el, flag_create);
+}
+
+/* Retrieve an element using its id (as found in relation lines).
+ return values:
+ -1 error occured
+  0 element is not live (element is filled in if it is in the trash)
+  1 element exists
+*/
+int elem_get(int type, unsigned int id, ELEM* el) {
+    char line[ELEM_NAME_MAX+64];
+    if(!catalog_line(type, id, line, sizeof(line))) {
+        return -1;
+    }
+    char* name = strchr(line, ' ');
+    if(line[0] == CAT_GONE || !name) {
+        return 0;
+    }
+    *name++ = 0;
+    el->type = type;
+    el->id = id;
+    el->name = xstrdup(name);
+    el->file = xmalloc(strlen(ELEM_DIR[type])+strlen(line)+3*FANOUT_MAX+strlen(ELEM_TRASH)+2);
+    elem_path(el->file, type, line+1, db_config.fanout);
+    if(line[0] == CAT_TRASH) {
+        strcat(el->file, ELEM_TRASH);
+        return 0;
+    }
+    return 1;
+}
+
+/* state of a relation, as resolved from an element file */
+typedef struct relation {
+    unsigned int id;        // id of the related element
+    char state;             // ELEM_ADD or ELEM_REM
+} RELATION;
+
+static int file_compact(char* file, char status, char* peers, unsigned int peers_count,
+                        RELATION* changes, size_t changes_count, int* delta, long* reclaimed);
+static int counter_relate(ELEM* elem, int delta);
+
+/* change of a relation of a file, pending in the journal of a database having the 'lazy' inverse setting */
+typedef struct inverse_rec {
+    uint32_t id;            // id of the file
+    uint32_t rel_id;        // id of the tag
+    uint32_t action;        // ELEM_ADD or ELEM_REM
+} INVERSE_REC;
+
+static int inverse_lazy(void);
+static int inverse_append(INVERSE_REC* recs, size_t count);
+static int inverse_sync(int type);
+
+/* one-sided relation change, logged in the journal of the command before being applied (see elem_sync_journal) */
+typedef struct journal_rec {
+    uint32_t type;          // type of the element to update
+    uint32_t id;            // id of the element to update
+    uint32_t rel_id;        // id of the related element
+    uint32_t action;        // ELEM_ADD or ELEM_REM
+} JOURNAL_REC;
+
+/* Look for the record of an id in the packed block of an element file, starting at given position.
+ If the block has a skip table (at given position in the block), only the segment that may hold the
+ record is read.
+ Returns the state of the relation (ELEM_ADD or ELEM_REM), 0 if there is none, -1 on error.
+*/
+static int block_find(char* file, long start, size_t packed, size_t skip, unsigned int id) {
+    unsigned int rec_id = 0;
+    size_t seg_start = 0, seg_end = packed;
+    if(skip && skip < packed) {
+        char* table = xmalloc(packed-skip+1);
+        if(store_get(file, start+skip, table, packed-skip) != (long) (packed-skip)) {
+            free(table);
+            return -1;
+        }
+        size_t count;
+        SKIP_ENTRY* entries = skip_parse(table, table+packed-skip-1, skip-1, &count);
+        if(entries) {
+            size_t i = skip_find(entries, count, id);
+            rec_id = entries[i].base;
+            seg_start = entries[i].offset;
+            seg_end = (i+1 < count)?entries[i+1].offset:skip-1;
+            free(entries);
+        }
+        free(table);
+    }
+    size_t len = seg_end - seg_start;
+    char* buf = xmalloc(len+1);
+    if(store_get(file, start+seg_start, buf, len) != (long) len) {
+        free(buf);
+        return -1;
+    }
+    char* end = buf + len;
+    char state = 0;
+    int res = 0;
+    // records are sorted by id
+    for(char* ptr = buf; (ptr = rel_unpack(ptr, end, &rec_id, &state)) && rec_id <= id; ) {
+        if(rec_id == id) {
+            res = state;
+            break;
+        }
+    }
+    free(buf);
+    return res;
+}
+
+/* Create or suppress the record of a relation in the file of given element (see elem_link).
+ Unless the Bloom filter of the element tells that there is no such relation yet, the relation is
+ looked for by binary search among the sorted block, then among the tail: if found, its state is
+ updated in place. Otherwise a new line is appended to the tail.
+ (a packed block is decoded instead of searched, one segment only if it has a skip table, and a
+ relation it holds is updated by appending a new line to the tail)
+ return codes: same as elem_relate
+*/
+static int link_record(char action, ELEM* elem, unsigned int id) {
+    char* head = xmalloc(ELEM_NAME_MAX+BLOOM_BITS_MAX/4+64);
+    if(!store_head(elem->file, head, ELEM_NAME_MAX+BLOOM_BITS_MAX/4+64)) {
+        free(head);
+        return -1;
+    }
+    size_t block, packed, skip;
+    char* filter;
+    long start = head_parse(head, NULL, &block, &filter, &packed, &skip) - head;
+    size_t filter_len = (filter)?strcspn(filter, "\n"):0;
+    if(filter && (filter[filter_len] != '\n' || filter_len < BLOOM_BITS_MIN/4 || (filter_len & (filter_len-1)))) {
+        // incomplete or malformed filter : ignore it
+        filter = NULL;
+    }
+    long tail = start + (long) ((packed)?packed:block * REL_SIZE);
+    long len = store_size(elem->file) - tail;
+    if(len < 0) {
+        free(head);
+        return -1;
+    }
+    size_t lines = len / REL_SIZE;
+    int res = -1;
+    // state of the relation held by a packed block (if any)
+    int state = 0;
+    if(!filter || bloom_test(filter, filter_len, id)) {
+        // relation may exist : look for it
+        char rec[REL_SIZE+1];
+        size_t lo = 0, hi = (packed)?0:block;
+        while(lo < hi) {
+            size_t mid = (lo+hi)/2;
+            long pos = start + (long) mid * REL_SIZE;
+            if(store_get(elem->file, pos, rec, REL_SIZE) != REL_SIZE) {
+                free(head);
+                return -1;
+            }
+            rec[REL_SIZE] = 0;
+            unsigned int rec_id = strtoul(rec+1, NULL, 10);
+            if(rec_id == id) {
+                res = (rec[0] == action)?0:(store_patch(elem->file, pos, &action, 1)?1:-1);
+                free(head);
+                return res;
+            }
+            if(rec_id < id) lo = mid+1;
+            else hi = mid;
+        }
+        // not in the block : look for the last line mentioning the same id in the tail
+        long found = -1;
+        if(len > 0) {
+            char* buf = xmalloc(len+1);
+            if(store_get(elem->file, tail, buf, len) != len) {
+                free(buf);
+                free(head);
+                return -1;
+            }
+            buf[len] = 0;
+            lines = 0;
+            for(char* line = buf; *line; ) {
+                char* eol = line + strcspn(line, "\n");
+                // a line without new line char was torn by a crash : it is ignored
+                if(*eol && (line[0] == ELEM_ADD || line[0] == ELEM_REM)) {
+                    ++lines;
+                    if(strtoul(line+1, NULL, 10) == id) found = line-buf;
+                }
+                line = (*eol)?eol+1:eol;
+            }
+            if(found >= 0) {
+                res = (buf[found] == action)?0:(store_patch(elem->file, tail+found, &action, 1)?1:-1);
+            }
+            free(buf);
+        }
+        if(found >= 0) {
+            free(head);
+            return res;
+        }
+        if(packed && (state = block_find(elem->file, start, packed, skip, id)) < 0) {
+            free(head);
+            return -1;
+        }
+    }
+    if(state == action || (!state && action == ELEM_REM)) {
+        // relation already in that state, or no such relation
+        free(head);
+        return 0;
+    }
+    if(lines >= REL_TAIL_MAX || len % REL_SIZE) {
+        // tail is full (or ends with a torn line) : merge it into the block, then try again
+        res = file_compact(elem->file, 0, NULL, 0, NULL, 0, NULL, NULL);
+        if(res != 0) {
+            free(head);
+            return (res < 0)?-1:link_record(action, elem, id);
+        }
+    }
+    // keep the filter up to date, before the record is written (should the filter be torn by a crash,
+    // it misses bits of a relation that is not recorded yet)
+    if(filter && bloom_add(filter, filter_len, id) && !store_patch(elem->file, filter-head, filter, filter_len)) {
+        free(head);
+        return -1;
+    }
+    char rec[REL_SIZE+1];
+    sprintf(rec, "%c%0*u\n", action, REL_DIGITS, id);
+    res = store_append(elem->file, rec, REL_SIZE)?((state)?1:2):-1;
+    free(head);
+    return res;
+}
+
+/* Create or suppress a relation from given element to the element having given id
+ (the related element is left untouched), and update the relations count of the element.
+ return codes: same as elem_relate
+*/
+int elem_link(char action, ELEM* elem, unsigned int id) {
+    int res = link_record(action, elem, id);
+    if(res > 0) {
+        COUNT_CHANGE change = {elem->id, (action == ELEM_ADD)?1:-1};
+        if(!counter_update(elem->type, &change, 1)) res = -1;
+    }
+    return res;
+}
+
+/* Create or suppress a symetrical relation between given elements.
+ return codes:
+ -1 : error
+ 0  : nothing done
+ 1  : updated relation
+ 2  : new relation
+ 
+ Relations are defined using lines starting with a '+' (or '-' if relation was removed) and ending with a '\n'
+ (a relation can be mentioned several times, the last line being the one that counts).
+ Under windows, if user edit file manually, end of line might be changed into "\r\n" 
+ which would prevent name detection (this possibility is not handled here).
+*/
+int elem_relate(char action, ELEM* elem1, ELEM* elem2) {
+    // check that we were given actual elements
+    if(elem1 == NULL || elem2 == NULL) {
+        return -1;
+    }
+    if(elem1->type == elem2->type) {
+        // cannot relate two elements of the same type (i.e. tagging a tag)
+        return -1;
+    }
+
+    // both sides are logged first, so that a crash does not leave the relation asymmetric
+    JOURNAL_REC recs[2] = {{elem1->type, elem1->id, elem2->id, action}, {elem2->type, elem2->id, elem1->id, action}};
+    if(!store_journal((char*) recs, sizeof(recs))) {
+        return -1;
+    }
+    if(inverse_lazy()) {
+        // relations of the file are derived from the ones of the tag
+        ELEM* tag = (elem1->type == ELEM_TAG)?elem1:elem2;
+        ELEM* file = (elem1->type == ELEM_TAG)?elem2:elem1;
+        INVERSE_REC rec = {file->id, tag->id, action};
+        int result = elem_link(action, tag, file->id);
+        if(result > 0 && !inverse_append(&rec, 1)) {
+            return -1;
+        }
+        return result;
+    }
+    // we assume consistency, i.e. relations are symetrical
+    int result = elem_link(action, elem1, elem2->id);
+    if(result < 0) {
+        return result;
+    }
+    // do the same for symetrical relation
+    if(elem_link(action, elem2, elem1->id) < 0) {
+        return -1;
+    }
+    return result;
+}
+
+/* Move an element to the trash (its file is renamed with a '.trash' extension).
+*/
+int elem_trash(ELEM* elem) {
+    // pending changes are applied while the element is still live (so that they are counted),
+    // then the element is no longer counted by the related elements
+    if(!elem_sync_inverse() || !counter_relate(elem, -1)) {
+        return 0;
+    }
+    char* trash_file = xmalloc(strlen(elem->file)+strlen(ELEM_TRASH)+1);
+    sprintf(trash_file, "%s%s", elem->file, ELEM_TRASH);
+    // a previously trashed element by that name is about to be overwritten
+    unsigned int trash_id = 0;
+    elem_head(trash_file, NULL, &trash_id);
+    int res = store_rename(elem->file, trash_file);
+    free(trash_file);
+    if(res) {
+        res = (!trash_id || catalog_update(elem->type, trash_id, CAT_TRASH, CAT_GONE))
+           && catalog_update(elem->type, elem->id, CAT_LIVE, CAT_TRASH)
+           && trash_add(elem->type, elem->id);
+    }
+    return res;
+}
+
+/* Restore a previously trashed element.
+ return values:
+ -1 element could not be restored
+  0 element was not found in trash
+  1 element was restored
+*/
+int elem_recover(int type, char* name, ELEM* el) {
+    if(type == ELEM_FILE) {
+        // file might no longer exist in the filesystem
+        char* path = get_path(name);
+        if(path) name = path;
+    }
+    if(elem_open(type, name, el, 0) != 0) {
+        // an element by that name already exists
+        return -1;
+    }
+    char* trash_file = xmalloc(strlen(el->file)+strlen(ELEM_TRASH)+1);
+    sprintf(trash_file, "%s%s", el->file, ELEM_TRASH);
+    char trash_name[ELEM_NAME_MAX];
+    int res = -1;
+    if(!elem_head(trash_file, trash_name, &el->id) || strcmp(trash_name, el->name) != 0) {
+        // unable to find trash file
+        res = 0;
+    }
+    else if(store_rename(trash_file, el->file) && catalog_update(type, el->id, CAT_TRASH, CAT_LIVE)
+            && counter_relate(el, 1)) {
+        res = 1;
+    }
+    free(trash_file);
+    return res;
+}
+
+/* relation line found in the tail of an element file */
+struct tail_line {
+    RELATION rel;
+    size_t pos;             // position of the line in the tail
+};
+
+/* Compare two relation lines by related element, then by position in the file.
+*/
+static int relation_cmp(const void* a, const void* b) {
+    const struct tail_line* line1 = a;
+    const struct tail_line* line2 = b;
+    if(line1->rel.id != line2->rel.id) {
+        return (line1->rel.id < line2->rel.id)?-1:1;
+    }
+    return (line1->pos < line2->pos)?-1:1;
+}
+
+/* Resolve the relations held by the tail of an element file, starting at given line.
+ Returns an array giving the current state of each relation mentioned in the tail (i.e. last line
+ for each related element), sorted by id. Count is set to the size of the array, and lines to the
+ count of lines of the tail.
+ (returned array has to be freed by caller)
+*/
+static RELATION* tail_fold(char* line, size_t* count, size_t* lines) {
+    size_t size = 16, n = 0;
+    struct tail_line* tail_lines = xmalloc(sizeof(struct tail_line) * size);
+    *lines = 0;
+    while(*line) {
+        if(!line[strcspn(line, "\n")]) {
+            // line without new line char (torn by a crash) : it is ignored, but counted so that
+            // the tail gets compacted
+            ++*lines;
+            break;
+        }
+        if(line[0] == ELEM_ADD || line[0] == ELEM_REM) {
+            if(n == size) {
+                size *= 2;
+                tail_lines = xrealloc(tail_lines, sizeof(struct tail_line) * size);
+            }
+            struct tail_line* tail_line = &tail_lines[n];
+            tail_line->rel.id = strtoul(line+1, NULL, 10);
+            tail_line->rel.state = line[0];
+            tail_line->pos = n++;
+            ++*lines;
+        }
+        line += strcspn(line, "\n");
+        if(*line) ++line;
+    }
+    // keep only the last line of each id
+    qsort(tail_lines, n, sizeof(struct tail_line), relation_cmp);
+    RELATION* rels = xmalloc(sizeof(RELATION) * (n+1));
+    *count = 0;
+    for(size_t i = 0; i < n; ++i) {
+        if(i+1 < n && tail_lines[i].rel.id == tail_lines[i+1].rel.id) continue;
+        rels[(*count)++] = tail_lines[i].rel;
+    }
+    free(tail_lines);
+    return rels;
+}
+
+/* Decode the records of a packed block, from ptr to end, into an array of at most size relations.
+ Id is the one of the record that precedes the first one.
+ Returns the count of decoded relations (decoding stops at first malformed record).
+*/
+static size_t block_decode(char* ptr, char* end, unsigned int id, RELATION* rels, size_t size) {
+    size_t count = 0;
+    char state;
+    while(count < size && (ptr = rel_unpack(ptr, end, &id, &state))) {
+        rels[count].id = id;
+        rels[count++].state = state;
+    }
+    return count;
+}
+
+/* Resolve the relations held by given file content (which is left untouched, so that it can
+ be read straight from a mapped file).
+ Returns an array giving the current state of each relation (i.e. last line for each related
+ element), sorted by id. Count is set to the size of the array, and tail to the count of lines
+ found after the sorted block.
+ (returned array has to be freed by caller)
+*/
+static RELATION* elem_fold(char* buf, size_t* count, size_t* tail) {
+    size_t block, packed;
+    char* line = head_parse(buf, NULL, &block, NULL, &packed, NULL);
+    RELATION* rels = xmalloc(sizeof(RELATION) * (block+1));
+    *count = 0;
+    if(packed && strnlen(line, packed) == packed && line[packed-1] == '\n') {
+        // packed block : records line, then skip table (stops at first malformed record)
+        *count = block_decode(line, line + strcspn(line, "\n"), 0, rels, block);
+        line += packed;
+    }
+    else {
+        // sorted block (stops at first malformed record)
+        while(*count < block && strnlen(line, REL_SIZE) == REL_SIZE && line[REL_SIZE-1] == '\n'
+              && (line[0] == ELEM_ADD || line[0] == ELEM_REM)) {
+            rels[*count].id = strtoul(line+1, NULL, 10);
+            rels[(*count)++].state = line[0];
+            line += REL_SIZE;
+        }
+    }
+    block = *count;
+    // unsorted tail
+    size_t tail_count;
+    RELATION* tail_rels = tail_fold(line, &tail_count, tail);
+    if(tail_count == 0) {
+        free(tail_rels);
+        return rels;
+    }
+    // merge tail with the block
+    RELATION* result = xmalloc(sizeof(RELATION) * (block+tail_count+1));
+    size_t i = 0, j = 0, k = 0;
+    while(i < block || j < tail_count) {
+        if(j == tail_count) result[k++] = rels[i++];
+        else if(i == block || rels[i].id > tail_rels[j].id) result[k++] = tail_rels[j++];
+        else if(rels[i].id < tail_rels[j].id) result[k++] = rels[i++];
+        else {
+            // tail supersedes block
+            ++i;
+            result[k++] = tail_rels[j++];
+        }
+    }
+    free(tail_rels);
+    free(rels);
+    *count = k;
+    return result;
+}
+
+/* Populate a list with nodes holding ids of the relations found in given file content.
+ If status is 0, removed relations are retrieved as well.
+*/
+static int elem_parse(char* buf, char status, LIST* list) {
+    size_t count, tail;
+    RELATION* rels = elem_fold(buf, &count, &tail);
+    // relations come sorted by id : each one is appended after the previous one
+    // (if list already holds nodes, it gets sorted once, when used)
+    for(size_t i = 0; i < count; ++i) {
+        // ignore obsolete relations (unless requested)
+        if((rels[i].state == ELEM_ADD || !status) && rels[i].id) {
+            list_append(list, rels[i].id, NULL);
+        }
+    }
+    free(rels);
+    return 0;
+}
+
+/* Populate a list with nodes holding ids of the elements pointed by the given element.
+ Element file is mapped and parsed in place (see store_map).
+*/
+int elem_retrieve_list(ELEM* elem, LIST* list) {
+    if(!inverse_sync(elem->type)) {
+        return -1;
+    }
+    size_t len;
+    char* buf = store_map(elem->file, &len);
+    if(buf == NULL) {
+        return -1;
+    }
+    int result = elem_parse(buf, ELEM_ADD, list);
+    store_unmap(buf, len);
+    return result;
+}
+
+/* Populate a list with nodes holding ids of all the elements ever related to the given element
+ (i.e. including removed relations).
+*/
+int elem_retrieve_all(ELEM* elem, LIST* list) {
+    if(!inverse_sync(elem->type)) {
+        return -1;
+    }
+    size_t len;
+    char* buf = store_map(elem->file, &len);
+    if(buf == NULL) {
+        return -1;
+    }
+    int result = elem_parse(buf, 0, list);
+    store_unmap(buf, len);
+    return result;
+}
+
+/* Find the state of a relation among relations sorted by id, starting at given position (which is
+ updated, so that ids looked for in ascending order are found in a single pass).
+ Returns ELEM_ADD or ELEM_REM, or 0 if there is no such relation.
+*/
+static char rel_state(RELATION* rels, size_t count, size_t* pos, unsigned int id) {
+    while(*pos < count && rels[*pos].id < id) ++*pos;
+    return (*pos < count && rels[*pos].id == id)?rels[*pos].state:0;
+}
+
+/* Keep only the nodes of a list (sorted by id) holding ids of elements related to given element.
+ If the relations block of the element has a skip table, only the segments that may hold ids of
+ the list are decoded, so that a short list is intersected with a large element without reading
+ most of its file.
+*/
+int elem_filter_list(ELEM* elem, LIST* list) {
+    if(!inverse_sync(elem->type)) {
+        return -1;
+    }
+    size_t len;
+    char* buf = store_map(elem->file, &len);
+    if(buf == NULL) {
+        return -1;
+    }
+    size_t block, packed, skip, count, tail, seg_count = 0;
+    char* line = head_parse(buf, NULL, &block, NULL, &packed, &skip);
+    SKIP_ENTRY* entries = NULL;
+    if(packed && skip && skip < packed && strnlen(line, packed) == packed && line[packed-1] == '\n') {
+        entries = skip_parse(line+skip, line+packed-1, skip-1, &seg_count);
+    }
+    // relations held by the tail only (segments are decoded when needed), or all relations
+    RELATION* rels = (entries)?tail_fold(line+packed, &count, &tail):elem_fold(buf, &count, &tail);
+    RELATION* seg_rels = (entries)?xmalloc(sizeof(RELATION) * REL_SEGMENT):NULL;
+    size_t seg = seg_count, seg_size = 0, i = 0, j = 0;
+    int kept = 0;
+    list_sort(list);
+    for(int n = 0; n < list->count; ++n) {
+        NODE* node = &list->nodes[n];
+        char state = rel_state(rels, count, &i, node->id);
+        if(!state && entries) {
+            size_t k = skip_find(entries, seg_count, node->id);
+            if(k != seg) {
+                char* end = line + ((k+1 < seg_count)?entries[k+1].offset:skip-1);
+                seg_size = block_decode(line+entries[k].offset, end, entries[k].base, seg_rels, REL_SEGMENT);
+                seg = k;
+                j = 0;
+            }
+            state = rel_state(seg_rels, seg_size, &j, node->id);
+        }
+        if(state == ELEM_ADD && node->id) {
+            list->nodes[kept++] = *node;
+        }
+        else free(node->str);
+    }
+    list->count = kept;
+    free(seg_rels);
+    free(entries);
+    free(rels);
+    store_unmap(buf, len);
+    return 0;
+}
+
+/* Tell if a relation is kept when compacting an element file (see file_compact).
+*/
+static int rel_kept(RELATION* rel, char status, char* peers, unsigned int peers_count) {
+    if(status && rel->state != status) {
+        return 0;
+    }
+    return !peers || rel->id > peers_count || peers[rel->id] != CAT_GONE;
+}
+
+/* Merge the tail of an element file into its sorted block, so that it holds one record per related element.
+ If status is ELEM_ADD, removed relations are dropped as well.
+ If given, peers holds the states of the related elements by id (see catalog_load): relations to
+ elements that are gone are dropped.
+ If given, changes (sorted by id, one per id) are merged at the same time, and supersede
+ the current state of the relations (if given, delta is increased by the change of the count of
+ relations they make).
+ If given, reclaimed is increased by the number of bytes saved.
+ return values:
+ -1 error occured
+  0 file was already compacted (and left unchanged)
+  1 file has been rewritten
+*/
+static int file_compact(char* file, char status, char* peers, unsigned int peers_count,
+                        RELATION* changes, size_t changes_count, int* delta, long* reclaimed) {
+    size_t len;
+    char* buf = store_read(file, &len);
+    if(buf == NULL) {
+        return -1;
+    }
+    unsigned int id;
+    size_t block, packed, skip;
+    char* filter;
+    head_parse(buf, &id, &block, &filter, &packed, &skip);
+    if(!id) {
+        // no id : relations are stored by name (database created by a former version)
+        free(buf);
+        return (changes_count)?-1:0;
+    }
+    size_t name_len = strcspn(buf, "\n");
+    size_t count, tail;
+    RELATION* rels = elem_fold(buf, &count, &tail);
+    int changed = 0;
+    if(changes_count) {
+        // merge changes with the current relations
+        RELATION* merged = xmalloc(sizeof(RELATION) * (count+changes_count));
+        size_t i = 0, j = 0, k = 0;
+        while(i < count || j < changes_count) {
+            unsigned long id1 = (i < count)?rels[i].id:ULONG_MAX;
+            unsigned long id2 = (j < changes_count)?changes[j].id:ULONG_MAX;
+            if(id1 < id2) merged[k++] = rels[i++];
+            else if(id1 > id2) {
+                // new relation (suppressing a relation that does not exist does nothing)
+                if(changes[j].state == ELEM_ADD) {
+                    merged[k++] = changes[j];
+                    changed = 1;
+                    if(delta) ++*delta;
+                }
+                ++j;
+            }
+            else {
+                if(rels[i].state != changes[j].state) {
+                    changed = 1;
+                    if(delta) *delta += (changes[j].state == ELEM_ADD)?1:-1;
+                }
+                merged[k++] = changes[j++];
+                ++i;
+            }
+        }
+        free(rels);
+        rels = merged;
+        count = k;
+    }
+    size_t kept = 0;
+    for(size_t i = 0; i < count; ++i) {
+        if(rel_kept(&rels[i], status, peers, peers_count)) ++kept;
+    }
+    int pack = (kept >= REL_PACK_MIN);
+    // a packed block of several segments has a skip table
+    int segmented = (kept > REL_SEGMENT);
+    int res = 0;
+    if(changed || tail || kept < count || !filter || strcspn(filter, "\n") != bloom_size(kept) || pack != (packed > 0)
+       || (pack && segmented != (skip > 0))) {
+        // rewritten file : header (full name of the element, its id and the count of relations, Bloom filter),
+        // then the sorted block (packed if large enough, with its skip table)
+        size_t filter_len = bloom_size(kept);
+        char* bloom = xmalloc(filter_len+1);
+        memset(bloom, '0', filter_len);
+        bloom[filter_len] = 0;
+        size_t seg_count = 0;
+        SKIP_ENTRY* entries = xmalloc(sizeof(SKIP_ENTRY) * (kept/REL_SEGMENT+1));
+        char* records = xmalloc(kept * REL_SIZE + (kept/REL_SEGMENT+1) * 16 + 2);
+        size_t records_len = 0;
+        unsigned int prev_id = 0;
+        for(size_t i = 0, n = 0; i < count; ++i) {
+            if(!rel_kept(&rels[i], status, peers, peers_count)) continue;
+            unsigned int rel_id = rels[i].id;
+            bloom_add(bloom, filter_len, rel_id);
+            if(pack) {
+                if(n++ % REL_SEGMENT == 0) {
+                    entries[seg_count].base = prev_id;
+                    entries[seg_count++].offset = records_len;
+                }
+                records_len += rel_pack(records+records_len, rel_id-prev_id, rels[i].state);
+                prev_id = rel_id;
+            }
+            else {
+                records_len += sprintf(records+records_len, "%c%0*u\n", rels[i].state, REL_DIGITS, rel_id);
+            }
+        }
+        size_t skip_pos = 0;
+        if(pack) {
+            records[records_len++] = '\n';
+            if(segmented) {
+                skip_pos = records_len;
+                records_len += skip_pack(records+records_len, entries, seg_count);
+            }
+        }
+        free(entries);
+        char* out = xmalloc(name_len + filter_len + 96 + records_len);
+        size_t out_len = sprintf(out, "%.*s\n%c%u %zu", (int) name_len, buf, ELEM_ID, id, kept);
+        if(pack) out_len += sprintf(out+out_len, " %zu", records_len);
+        if(skip_pos) out_len += sprintf(out+out_len, " %zu", skip_pos);
+        out_len += sprintf(out+out_len, "\n%c%s\n", ELEM_BLOOM, bloom);
+        memcpy(out+out_len, records, records_len);
+        out_len += records_len;
+        res = store_write(file, out, out_len)?1:-1;
+        if(res > 0 && reclaimed && len > out_len) *reclaimed += len-out_len;
+        free(out);
+        free(records);
+        free(bloom);
+    }
+    free(rels);
+    free(buf);
+    return res;
+}
+
+/* Merge the relations tail of an element into its sorted block (see file_compact for return values).
+*/
+int elem_compact(ELEM* elem) {
+    if(!inverse_sync(elem->type)) {
+        return -1;
+    }
+    return file_compact(elem->file, 0, NULL, 0, NULL, 0, NULL, NULL);
+}
+
+/* Add given delta to the relations counts of the elements related to given element
+ (i.e.: given element is no longer counted, or counted again).
+*/
+static int counter_relate(ELEM* elem, int delta) {
+    int type = (elem->type%2)+1;
+    char* cnt_file = catalog_file(type, CNT_EXT);
+    int res = store_exists(cnt_file);
+    free(cnt_file);
+    if(!res) {
+        // counts are computed when read
+        return 1;
+    }
+    size_t len;
+    char* buf = store_map(elem->file, &len);
+    if(buf == NULL) {
+        return 0;
+    }
+    size_t count, tail, k = 0;
+    RELATION* rels = elem_fold(buf, &count, &tail);
+    COUNT_CHANGE* changes = xmalloc(sizeof(COUNT_CHANGE) * (count+1));
+    for(size_t i = 0; i < count; ++i) {
+        if(rels[i].state == ELEM_ADD && rels[i].id) {
+            changes[k].id = rels[i].id;
+            changes[k++].delta = delta;
+        }
+    }
+    res = counter_update(type, changes, k);
+    free(changes);
+    free(rels);
+    store_unmap(buf, len);
+    return res;
+}
+
+/* Count the live relations of the element held by a file.
+*/
+static int counter_scan(char* name, void* data) {
+    struct scan_data* scan = data;
+    char* elem_file = xmalloc(strlen(ELEM_DIR[scan->type])+strlen(name)+2);
+    sprintf(elem_file, "%s/%s", ELEM_DIR[scan->type], name);
+    size_t len;
+    char* buf = store_map(elem_file, &len);
+    free(elem_file);
+    if(buf == NULL) {
+        return 0;
+    }
+    unsigned int id;
+    head_parse(buf, &id, NULL, NULL, NULL, NULL);
+    if(id && id <= scan->counts_count) {
+        size_t count, tail;
+        uint32_t live = 0;
+        RELATION* rels = elem_fold(buf, &count, &tail);
+        for(size_t i = 0; i < count; ++i) {
+            unsigned int rel_id = rels[i].id;
+            if(rels[i].state == ELEM_ADD && rel_id && rel_id <= scan->names_count && scan->states[rel_id] == CAT_LIVE) ++live;
+        }
+        scan->counts[id-1] = live;
+        free(rels);
+    }
+    store_unmap(buf, len);
+    return 1;
+}
+
+/* Compute the relations counts of all elements of given type from their files.
+*/
+static int counter_build(int type) {
+    struct scan_data scan = {type, 0, NULL, NULL, 0, NULL, 0, NULL, NULL, 0};
+    char** names = catalog_load((type%2)+1, &scan.names_count, &scan.states);
+    catalog_free(names, scan.names_count);
+    char* idx_file = catalog_file(type, IDX_EXT);
+    long idx_size = store_size(idx_file);
+    if(idx_size < 0 && catalog_build(type)) {
+        idx_size = store_size(idx_file);
+    }
+    free(idx_file);
+    if(!names || idx_size < 0) {
+        free(scan.states);
+        return 0;
+    }
+    scan.counts_count = idx_size / sizeof(uint64_t);
+    scan.counts = xzalloc(sizeof(uint32_t) * (scan.counts_count+1));
+    int res = store_scan((char*) ELEM_DIR[type], counter_scan, &scan);
+    if(res) {
+        char* cnt_file = catalog_file(type, CNT_EXT);
+        res = store_write(cnt_file, (char*) scan.counts, sizeof(uint32_t) * scan.counts_count);
+        free(cnt_file);
+    }
+    free(scan.counts);
+    free(scan.states);
+    return res;
+}
+
+/* Make sure the relations counts of given type of elements are up to date and match the catalog
+ (they are computed if needed).
+*/
+static int counter_check(int type) {
+    if(!inverse_sync(type)) {
+        return 0;
+    }
+    char* cnt_file = catalog_file(type, CNT_EXT);
+    char* idx_file = catalog_file(type, IDX_EXT);
+    long size = store_size(cnt_file);
+    long idx_size = store_size(idx_file);
+    free(idx_file);
+    free(cnt_file);
+    return (idx_size >= 0 && size == (long) (idx_size / sizeof(uint64_t) * sizeof(uint32_t))) || counter_build(type);
+}
+
+/* Obtain the count of live elements related to given element (read from the relations counts).
+ Returns -1 on error.
+*/
+long elem_count(ELEM* elem) {
+    if(!elem->id || !counter_check(elem->type)) {
+        return -1;
+    }
+    char* cnt_file = catalog_file(elem->type, CNT_EXT);
+    uint32_t value;
+    long res = (store_get(cnt_file, (long) (elem->id-1) * sizeof(uint32_t), (char*) &value, sizeof(uint32_t)) == sizeof(uint32_t))?(long) value:-1;
+    free(cnt_file);
+    return res;
+}
+
+/* Append to the name held by each node of a list of elements of given type (nodes holding ids) the
+ count of live elements related to the element, separated by a tab (ex.: 'mp3\t12').
 */
+int elem_count_list(int type, LIST* list) {
+    if(!counter_check(type)) {
+        return 0;
+    }
+    char* cnt_file = catalog_file(type, CNT_EXT);
+    size_t len;
+    uint32_t* counts = (uint32_t*) store_read(cnt_file, &len);
+    free(cnt_file);
+    if(counts == NULL) {
+        return 0;
+    }
+    list_sort(list);
+    for(int i = 0; i < list->count; ++i) {
+        NODE* node = &list->nodes[i];
+        if(node->str && node->id && node->id <= len / sizeof(uint32_t)) {
+            char* str = xmalloc(strlen(node->str)+16);
+            sprintf(str, "%s\t%u", node->str, counts[node->id-1]);
+            free(node->str);
+            node->str = str;
+        }
+    }
+    free(counts);
+    return 1;
+}
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/types.h>
-#include <dirent.h>
-#include <glob.h>
-#include <fnmatch.h>
-#include <errno.h>
+/* relation change collected in a batch */
+typedef struct batch_change {
+    int type;               // type of the element to update
+    unsigned int id;        // id of the element to update
+    unsigned int rel_id;    // id of the related element
+    size_t seq;             // order of the change (the last one counts)
+    char action;            // ELEM_ADD or ELEM_REM
+} BATCH_CHANGE;
 
-#include "xalloc.h"
-#include "env.h"
-#include "hash.h"
-#include "list.h"
-#include "elem.h"
+struct batch {
+    BATCH_CHANGE* changes;
+    size_t count;
+    size_t size;
+};
 
-/* ELEM_DIR is defined in env.c
- Array holding the names of the sub-directories for database.
+/* Allocate an empty batch of relation changes.
 */
-extern const char* ELEM_DIR[];
+BATCH* batch_new() {
+    BATCH* batch = xzalloc(sizeof(BATCH));
+    batch->size = 64;
+    batch->changes = xmalloc(sizeof(BATCH_CHANGE) * batch->size);
+    return batch;
+}
 
-/* trash flag is defined in main driver (tagger.c)
-Allows to restrict current operation to trashed elements only.
+/* Append a one-sided relation change to a batch.
 */
-extern int trash_flag;
+static void batch_push(BATCH* batch, char action, ELEM* elem, unsigned int rel_id) {
+    if(batch->count == batch->size) {
+        batch->size *= 2;
+        batch->changes = xrealloc(batch->changes, sizeof(BATCH_CHANGE) * batch->size);
+    }
+    BATCH_CHANGE* change = &batch->changes[batch->count];
+    change->type = elem->type;
+    change->id = elem->id;
+    change->rel_id = rel_id;
+    change->seq = batch->count++;
+    change->action = action;
+}
 
+/* Record the creation or suppression of a symetrical relation between given elements
+ (nothing is written until batch_commit is called).
+ Returns -1 if elements cannot be related, 1 otherwise.
+*/
+int batch_relate(BATCH* batch, char action, ELEM* elem1, ELEM* elem2) {
+    if(elem1 == NULL || elem2 == NULL || elem1->type == elem2->type || !elem1->id || !elem2->id) {
+        return -1;
+    }
+    batch_push(batch, action, elem1, elem2->id);
+    batch_push(batch, action, elem2, elem1->id);
+    return 1;
+}
 
+/* Compare two relation changes by updated element, then by related element, then by order.
+*/
+static int batch_cmp(const void* a, const void* b) {
+    const BATCH_CHANGE* change1 = a;
+    const BATCH_CHANGE* change2 = b;
+    if(change1->type != change2->type) return (change1->type < change2->type)?-1:1;
+    if(change1->id != change2->id) return (change1->id < change2->id)?-1:1;
+    if(change1->rel_id != change2->rel_id) return (change1->rel_id < change2->rel_id)?-1:1;
+    return (change1->seq < change2->seq)?-1:1;
+}
 
-/* Checks if a file matches a given element name
+/* Apply all changes of a batch : changes are grouped by element, and each element file is read
+ and rewritten once, with its relations tail merged at the same time (see file_compact).
+ If lazy is set, changes of files are appended to the journal instead, with a single write.
+ The batch is emptied.
+ Returns the count of elements that could not be updated.
 */
-int check_file(char* elem_name, char* file_name){
-    int res = -1;
-    char temp_name[ELEM_NAME_MAX];
-    FILE* stream = fopen(file_name, "r");
-    if(stream == NULL) {
-        // file does not exist yet
-        res = 0;
+static int batch_apply(BATCH* batch, int lazy) {
+    if(batch->count) {
+        qsort(batch->changes, batch->count, sizeof(BATCH_CHANGE), batch_cmp);
     }
-    else {
-        // read first line
-        if (fgets(temp_name, ELEM_NAME_MAX, stream)) {
-            // remove newline char
-            temp_name[strlen(temp_name)-1] = 0;
-            if(strcmp(temp_name, elem_name) == 0) {
-                // match
-                res = 1;
+    // changes are logged first (in their order), so that a crash does not leave relations asymmetric
+    JOURNAL_REC* logged = xmalloc(sizeof(JOURNAL_REC) * (batch->count+1));
+    for(size_t i = 0; i < batch->count; ++i) {
+        JOURNAL_REC rec = {batch->changes[i].type, batch->changes[i].id, batch->changes[i].rel_id, batch->changes[i].action};
+        logged[i] = rec;
+    }
+    int logged_res = !batch->count || store_journal((char*) logged, sizeof(JOURNAL_REC) * batch->count);
+    free(logged);
+    if(!logged_res) {
+        int errors = (int) batch->count;
+        batch->count = 0;
+        return errors;
+    }
+    RELATION* records = xmalloc(sizeof(RELATION) * (batch->count+1));
+    INVERSE_REC* recs = (lazy)?xmalloc(sizeof(INVERSE_REC) * (batch->count+1)):NULL;
+    size_t recs_count = 0;
+    // changes of the relations counts (the ones of each type are applied at once)
+    COUNT_CHANGE* counts = xmalloc(sizeof(COUNT_CHANGE) * (batch->count+1));
+    size_t counts_count = 0;
+    int errors = 0;
+    for(size_t i = 0; i < batch->count; ) {
+        int type = batch->changes[i].type;
+        unsigned int id = batch->changes[i].id;
+        size_t count = 0;
+        for(; i < batch->count && batch->changes[i].type == type && batch->changes[i].id == id; ++i) {
+            BATCH_CHANGE* change = &batch->changes[i];
+            // keep only the last change of each relation
+            if(i+1 < batch->count && change[1].type == type && change[1].id == id && change[1].rel_id == change->rel_id) continue;
+            records[count].id = change->rel_id;
+            records[count++].state = change->action;
+            if(lazy && type == ELEM_FILE) {
+                INVERSE_REC rec = {id, change->rel_id, change->action};
+                recs[recs_count++] = rec;
             }
         }
-        fclose(stream);
+        if(lazy && type == ELEM_FILE) continue;
+        ELEM elem = {type, id, NULL, NULL};
+        int delta = 0;
+        if(elem_get(type, id, &elem) <= 0 || file_compact(elem.file, 0, NULL, 0, records, count, &delta, NULL) < 0) {
+            ++errors;
+        }
+        else if(delta) {
+            counts[counts_count].id = id;
+            counts[counts_count++].delta = delta;
+        }
+        free(elem.name);
+        free(elem.file);
+        if(counts_count && (i == batch->count || batch->changes[i].type != type)) {
+            if(!counter_update(type, counts, counts_count)) ++errors;
+            counts_count = 0;
+        }
     }
-    return res;
+    if(recs_count && !inverse_append(recs, recs_count)) {
+        ++errors;
+    }
+    free(counts);
+    free(recs);
+    free(records);
+    batch->count = 0;
+    return errors;
 }
 
-/* Find the hashed filename (with full path) associated to an element (tag or file).
- In case of collision, name is resolved by adding an extension with an increment.
- (this function do not create new file and always returns a filename)
+/* Apply all changes of a batch (see batch_apply).
 */
-char* resolve_name(int type, char* name) {
-    char* install_dir = get_install_dir();
-    char* elem_id = hash(name);
-    // we add an extra 3 chars for optional increment (in case of collision), and 2 chars for slashes
-    char* elem_file = xmalloc(strlen(install_dir)+strlen(ELEM_DIR[type])+strlen(elem_id)+3+2+1);
-    sprintf(elem_file, "%s/%s/%s", install_dir, ELEM_DIR[type], elem_id);
-
-    // while a file by that name already exists (and is not related to the same element)
-    for(int inc = 1; check_file(name, elem_file) < 0; ++inc) {
-        // increment the name
-        sprintf(elem_file, "%s.%02d", elem_file, inc);
-    }
-    
-    return elem_file;
+int batch_commit(BATCH* batch) {
+    return batch_apply(batch, inverse_lazy());
 }
 
-/* Look into specified file for a line matching given name, and if it already exists set it to new status.
+/* Release a batch of relation changes.
 */
-int update_record(char status, char* file, char* name) {
-    int result = 0;
-    long int pos;
-    char line[ELEM_NAME_MAX];
-    FILE* fp = fopen(file, "r+");
+void batch_free(BATCH* batch) {
+    if(batch) {
+        free(batch->changes);
+        free(batch);
+    }
+}
 
-    if(fp == NULL) {
-        // something went wrong
-        return -1;
-    }    
-    // skip the first line (full name of the element)
-    fgets(line, ELEM_NAME_MAX, fp);
-    pos = ftell(fp);
-    while(fgets(line, ELEM_NAME_MAX, fp)) {
-        // remove the new line char
-        line[strlen(line)-1] = 0;
-        if(strcmp(line+1, name) == 0) {
-            // we found the element, go back to the beginning of the line
-            fseek(fp, pos, SEEK_SET);
-            fprintf(fp, "%c%s", status, name);
-            result = 1;
-            break;
+/* whether the journal of the relation changes of files is known to be empty (0), to hold
+ changes (1), or was not checked yet (-1) */
+static int inverse_pending = -1;
+
+/* Tell if the relations of files are derived from the ones of tags (see elem_sync_inverse).
+*/
+static int inverse_lazy(void) {
+    return strcmp(db_config.inverse, INVERSE_LAZY) == 0;
+}
+
+/* Append changes of relations of files to the journal.
+*/
+static int inverse_append(INVERSE_REC* recs, size_t count) {
+    char* inv_file = catalog_file(ELEM_FILE, INV_EXT);
+    int res = store_append(inv_file, (char*) recs, sizeof(INVERSE_REC) * count);
+    free(inv_file);
+    if(res) inverse_pending = 1;
+    return res;
+}
+
+/* Apply the relation changes journaled for files, with a single rewrite of each file, then empty
+ the journal. Changes are applied in the order they were journaled (so that the last one counts),
+ and changes of files that are no longer live are dropped.
+*/
+int elem_sync_inverse(void) {
+    if(!inverse_pending) {
+        return 1;
+    }
+    char* inv_file = catalog_file(ELEM_FILE, INV_EXT);
+    size_t len = 0;
+    INVERSE_REC* recs = (INVERSE_REC*) store_read(inv_file, &len);
+    int res = 1;
+    if(recs) {
+        BATCH* batch = batch_new();
+        for(size_t i = 0; i < len / sizeof(INVERSE_REC); ++i) {
+            ELEM file = {ELEM_FILE, recs[i].id, NULL, NULL};
+            if(recs[i].id && recs[i].rel_id) batch_push(batch, (char) recs[i].action, &file, recs[i].rel_id);
         }
-        pos = ftell(fp);
+        batch_apply(batch, 0);
+        batch_free(batch);
+        free(recs);
+        res = store_remove(inv_file);
     }
-    fclose(fp);
-    return result;
+    free(inv_file);
+    if(res) inverse_pending = 0;
+    return res;
 }
 
-/*
- return values:
- -1 error occured
-  0 element does not exist and was not created
-  1 element already exists (and was not created)
-  2 element was created  
+/* Complete the command that was interrupted by a crash, if any (see store_journal_read).
+ Element files are the reference (each of them is replaced at once), but the catalogs and their
+ indexes may have been left half-updated : they are rebuilt from element files. Then the relation
+ changes logged by the command are applied again (applying a change twice does nothing), so that
+ relations are symetrical. Changes of elements that are no longer live are dropped.
 */
-int elem_init(int type, char* name, ELEM* el, int flag_create) {
-    ELEM temp;
-    if(el == NULL) {
-        el = &temp;
-    }
-    if(type == ELEM_FILE){
-        if( !(name = get_path(name)) ) {
-            return -1;
-        }        
-    }        
-    el->type = type;
-    el->name = xmalloc(strlen(name)+1);
-    strcpy(el->name, name);
-    el->file = resolve_name(el->type, el->name);
-    
-    FILE* fp = fopen(el->file, "r");
-    if(fp != NULL) {
-        // file already exists and we assume it is consistent (i.e.: full name as first line)
-        fclose(fp);
+int elem_sync_journal(void) {
+    size_t len = 0;
+    char* buf = store_journal_read(&len);
+    if(buf == NULL) {
         return 1;
     }
-    else if(flag_create) {
-        // file does not exist yet
-        fp = fopen(el->file, "w");
-        if(fp == NULL) {
-            // error at file creation
-            return -1;
+    int res = catalog_build(ELEM_TAG) && catalog_build(ELEM_FILE);
+    if(res) {
+        JOURNAL_REC* recs = (JOURNAL_REC*) buf;
+        BATCH* batch = batch_new();
+        // a record torn by a crash is ignored (it was not applied)
+        for(size_t i = 0; i < len / sizeof(JOURNAL_REC); ++i) {
+            if((recs[i].type != ELEM_TAG && recs[i].type != ELEM_FILE) || !recs[i].id || !recs[i].rel_id) continue;
+            ELEM elem = {recs[i].type, recs[i].id, NULL, NULL};
+            batch_push(batch, (char) recs[i].action, &elem, recs[i].rel_id);
         }
-        // add a first line containing the full name of the element
-        fprintf(fp, "%s\n", el->name);
-        fclose(fp);
-        return 2;
+        batch_apply(batch, inverse_lazy());
+        batch_free(batch);
     }
-    return 0;
+    free(buf);
+    return res;
 }
 
+/* Make sure relations of elements of given type are up to date before reading them.
+*/
+static int inverse_sync(int type) {
+    return type != ELEM_FILE || elem_sync_inverse();
+}
 
-/* Create or suppress a symetrical relation between given elements.
- return codes:
- -1 : error
- 0  : nothing done
- 1  : updated relation
- 2  : new relation
- 
- Relations are defined using lines starting with a '+' (or '-' if relation was removed) and ending with a '\n'.
- Under windows, if user edit file manually, end of line might be changed into "\r\n" 
- which would prevent name detection (this possibility is not handled here).
+/* Populate a list with nodes holding ids and names of all elements of given type
+ (elements are read from the catalog, which is built first if missing, and trashed elements
+ from the trash index).
 */
-int elem_relate(char action, ELEM* elem1, ELEM* elem2) {
-    int result = 0;
-    // check that we were given actual elements
-    if(elem1 == NULL || elem2 == NULL) {
-        return -1;
+int type_retrieve_list(int type, LIST* list) {
+    if(trash_flag) {
+        return trash_retrieve_list(type, list);
     }
-    if(elem1->type == elem2->type) {
-        // cannot relate two elements of the same type (i.e. tagging a tag)
-        return -1;
+    char* buf = catalog_read(type, NULL);
+    if(buf == NULL) {
+        return 0;
+    }
+    unsigned int id = 0;
+    for(char* line = buf; *line; ) {
+        char* eol = strchr(line, '\n');
+        if(eol) *eol = 0;
+        char* name = strchr(line, ' ');
+        ++id;
+        if(line[0] == CAT_LIVE && name) {
+            list_append(list, id, xstrdup(name+1));
+        }
+        if(!eol) break;
+        line = eol+1;
     }
+    free(buf);
+    return 1;
+}
 
-    // we assume consistency, i.e. there is only one or zero line matching the related elem
-    
-    // try to update the relation if it already exists (if so, we overwrite it)
-    int res;
-    res = update_record(action, elem1->file, elem2->name);
-    if(res == 1) {
-        result = 1;
-    }
-    if(res == 0 && action == ELEM_ADD) {
-        // relation was not found and we need to create the relation
-        FILE* fp = fopen(elem1->file, "a");
-        // append a new line at the end of the file
-        fprintf(fp, "%c%s\n", ELEM_ADD, elem2->name);
-        fclose(fp);
-        result = 2;
+/* Compare two nodes by string.
+*/
+static int node_cmp(const void* a, const void* b) {
+    return strcmp(((NODE*) a)->str, ((NODE*) b)->str);
+}
+
+/* Replace the ids held by a list of elements of given type with the names of the elements
+ (this is meant for output: list is then sorted by name, and elements that are not live are removed,
+ since relations to deleted elements are kept until the database is cleaned).
+*/
+int elem_resolve_list(int type, LIST* list) {
+    list_sort(list);
+    NODE* nodes = list->nodes;
+    unsigned int count = list->count, missing = 0;
+    for(unsigned int i = 0; i < count; ++i) {
+        if(!nodes[i].str) ++missing;
     }
-    // do the same for symetrical relation
-    res = update_record(action, elem2->file, elem1->name);
-    if(res == 0 && action == ELEM_ADD) {
-        FILE* fp = fopen(elem2->file, "a");
-        fprintf(fp, "%c%s\n", ELEM_ADD, elem1->name);
-        fclose(fp);
+    // for large lists, reading the whole catalog at once is cheaper than reading the line of each id
+    unsigned int names_count = 0;
+    char* states = NULL;
+    char** names = (missing > CAT_LOOKUP_MAX)?catalog_load(type, &names_count, &states):NULL;
+    unsigned int j = 0;
+    for(unsigned int i = 0; i < count; ++i) {
+        NODE* node = &nodes[i];
+        if(!node->str && node->id) {
+            if(names) {
+                if(node->id <= names_count && names[node->id] && states[node->id] == CAT_LIVE) {
+                    node->str = xstrdup(names[node->id]);
+                }
+            }
+            else {
+                char line[ELEM_NAME_MAX+64];
+                char* name;
+                if(catalog_line(type, node->id, line, sizeof(line)) && line[0] == CAT_LIVE && (name = strchr(line, ' '))) {
+                    node->str = xstrdup(name+1);
+                }
+            }
+        }
+        node->id = 0;
+        if(node->str) nodes[j++] = *node;
     }
-    return result;
+    catalog_free(names, names_count);
+    free(states);
+    // nodes no longer hold ids : list is sorted by name
+    if(j) {
+        qsort(nodes, j, sizeof(NODE), node_cmp);
+    }
+    list->count = j;
+    return 1;
 }
 
+/* Move an element file to the location it has with given fan-out.
+*/
+static int relocate_elem(char* name, void* data) {
+    struct scan_data* scan = data;
+    char* base = strrchr(name, '/');
+    base = (base)?base+1:name;
+    char* old_file = xmalloc(strlen(ELEM_DIR[scan->type])+strlen(name)+2);
+    char* new_file = xmalloc(strlen(ELEM_DIR[scan->type])+strlen(base)+3*FANOUT_MAX+2);
+    sprintf(old_file, "%s/%s", ELEM_DIR[scan->type], name);
+    elem_path(new_file, scan->type, base, scan->fanout);
+    int res = (strcmp(old_file, new_file) == 0 || store_rename(old_file, new_file));
+    free(old_file);
+    free(new_file);
+    return res;
+}
 
-/* Populate a list with nodes holding names of the elements pointed by the given element.
- (this function calls list_insert_unique, which avoid duplicates)
+/* Move all files of given type (trashed ones included) to the location they have with given fan-out.
+ (this does not change db_config, which has to be updated once relocation is done)
 */
-int elem_retrieve_list(ELEM* elem, LIST* list) {
-    int result = 0;
-    char line[ELEM_NAME_MAX];
-    FILE* fp = fopen(elem->file, "r");
-    if(fp == NULL) {
+int type_relocate(int type, int fanout) {
+    struct scan_data scan = {type, 0, NULL, NULL, fanout};
+    int res = store_scan((char*) ELEM_DIR[type], relocate_elem, &scan);
+    store_prune((char*) ELEM_DIR[type]);
+    return res;
+}
+
+/* element renamed by type_move */
+struct move_entry {
+    unsigned int id;
+    char* line;             // new catalog line ('<state><hash code> <name>')
+    char* from_file;        // current file of the element
+};
+
+/* Compare the hash codes of the new files of two moved elements.
+*/
+static int move_code_cmp(const struct move_entry* entry1, const struct move_entry* entry2) {
+    size_t len1 = strcspn(entry1->line+1, " "), len2 = strcspn(entry2->line+1, " ");
+    int res = strncmp(entry1->line+1, entry2->line+1, (len1 < len2)?len1:len2);
+    return (res)?res:(len1 > len2) - (len1 < len2);
+}
+
+/* Compare two moved elements by the hash code of their new file, then by id.
+*/
+static int move_cmp(const void* a, const void* b) {
+    const struct move_entry* entry1 = a;
+    const struct move_entry* entry2 = b;
+    int res = move_code_cmp(entry1, entry2);
+    if(res) return res;
+    return (entry1->id > entry2->id) - (entry1->id < entry2->id);
+}
+
+/* Rename all the elements of given type (trashed ones included) whose name is given prefix, or starts
+ with given prefix followed by a path separator, replacing that prefix (ex.: files of a moved directory).
+ Prefixes must not contain each other (ex.: '/a' and '/a/b').
+ Elements to rename are found with the name index. They keep their id, so that related elements (whose
+ relations hold ids) are left untouched: the files of renamed elements are written under the hash of their
+ new name, the catalog is rewritten once, and the new names are added to the collision directory and
+ the name index (former slots of the collision directory no longer match any name and are skipped).
+ Elements whose new name is already used are left unchanged, and counted as ignored.
+ Returns the count of renamed elements, or -1 on error.
+*/
+int type_move(int type, char* from, char* to, int* ignored) {
+    size_t from_len = strlen(from);
+    LIST found = {NULL, 0, 0, 0};
+    if(!ord_range(type, from, from_len, 0, &found)) {
         return -1;
     }
-    // skip the first line (full name of the element)
-    fgets(line, ELEM_NAME_MAX, fp);
-    while(fgets(line, ELEM_NAME_MAX, fp)) {
-        // ignore obsolete relations
-        if(line[0] == '+') {
-            // remove the last char ('\n')
-            line[strlen(line)-1] = 0;
-            // add record to result list
-            NODE* node = xzalloc(sizeof(NODE));
-            node->str = (char*) xmalloc(strlen(line)+1);
-            //copy the line, omitting first char ('+' or '-')
-            strcpy(node->str, line+1);            
-            // though we should'nt encounter any duplicate, if we do anyway, just ignore them
-            if( list_insert_unique(list, node) < 0 ) {
-                // unexpected error occured 
-                return -1;
-            }
+    if(!found.count) {
+        return 0;
+    }
+    char* buf = catalog_read(type, NULL);
+    if(buf == NULL) {
+        list_free(&found);
+        return -1;
+    }
+    // catalog lines by id (starting with id 1)
+    size_t count = 0, size = 256;
+    char** lines = xmalloc(sizeof(char*) * size);
+    for(char* line = buf; *line; ) {
+        char* eol = strchr(line, '\n');
+        if(eol) *eol = 0;
+        if(count == size) {
+            size *= 2;
+            lines = xrealloc(lines, sizeof(char*) * size);
         }
+        lines[count++] = line;
+        if(!eol) break;
+        line = eol+1;
     }
-    fclose(fp);
-    return result;
+    size_t moved_count = 0, moved_size = 0;
+    struct move_entry* moved = NULL;
+    int res = 1;
+    char hash_code[ELEM_NAME_MAX], new_name[ELEM_NAME_MAX];
+    for(int i = 0; i < found.count && res; ++i) {
+        unsigned int id = found.nodes[i].id;
+        char* name = found.nodes[i].str;
+        // elements whose name only starts with the same chars (ex.: '/a/bc' for '/a/b') are skipped
+        if(name[from_len] && name[from_len] != PATH_SEPARATOR[0]) continue;
+        char* sep = (id && id <= count)?strchr(lines[id-1], ' '):NULL;
+        if(!sep || sep-lines[id-1]-1 >= ELEM_NAME_MAX) continue;
+        if(snprintf(new_name, sizeof(new_name), "%s%s", to, name+from_len) >= (int) sizeof(new_name)) {
+            ++(*ignored);
+            continue;
+        }
+        unsigned int found_id;
+        int found_res = map_find(type, new_name, hash_code, &found_id, NULL, NULL);
+        if(found_res) {
+            // new name is already used by another element
+            if(found_res < 0) res = 0;
+            else ++(*ignored);
+            continue;
+        }
+        if(moved_count == moved_size) {
+            moved_size = (moved_size)?moved_size*2:64;
+            moved = xrealloc(moved, sizeof(struct move_entry) * moved_size);
+        }
+        struct move_entry* entry = &moved[moved_count++];
+        char state = lines[id-1][0];
+        entry->id = id;
+        entry->line = xmalloc(strlen(hash_code)+strlen(new_name)+3);
+        sprintf(entry->line, "%c%s %s", state, hash_code, new_name);
+        // current hash code is the first token of the line
+        *sep = 0;
+        entry->from_file = xmalloc(strlen(ELEM_DIR[type])+strlen(lines[id-1])+3*FANOUT_MAX+strlen(ELEM_TRASH)+2);
+        elem_path(entry->from_file, type, lines[id-1]+1, db_config.fanout);
+        if(state == CAT_TRASH) strcat(entry->from_file, ELEM_TRASH);
+        *sep = ' ';
+    }
+    list_free(&found);
+    // elements whose new names collide would get the same hash code : only the first one is renamed
+    if(moved_count) {
+        qsort(moved, moved_count, sizeof(struct move_entry), move_cmp);
+    }
+    size_t kept = 0;
+    for(size_t i = 0; i < moved_count; ++i) {
+        if(kept && move_code_cmp(&moved[kept-1], &moved[i]) == 0) {
+            free(moved[i].line);
+            free(moved[i].from_file);
+            ++(*ignored);
+            continue;
+        }
+        moved[kept++] = moved[i];
+    }
+    moved_count = kept;
+
+    // 1) write the files of the elements under their new name (relations are copied as they are)
+    char* new_file = xmalloc(strlen(ELEM_DIR[type])+ELEM_NAME_MAX+3*FANOUT_MAX+strlen(ELEM_TRASH)+2);
+    for(size_t i = 0; i < moved_count && res; ++i) {
+        char* sep = strchr(moved[i].line, ' ');
+        *sep = 0;
+        elem_path(new_file, type, moved[i].line+1, db_config.fanout);
+        if(moved[i].line[0] == CAT_TRASH) strcat(new_file, ELEM_TRASH);
+        *sep = ' ';
+        size_t len;
+        char* content = store_read(moved[i].from_file, &len);
+        char* eol = (content)?strchr(content, '\n'):NULL;
+        res = (eol != NULL);
+        if(res) {
+            char* out = xmalloc(strlen(sep+1)+len+1);
+            size_t head = sprintf(out, "%s", sep+1);
+            memcpy(out+head, eol, len-(eol-content));
+            res = store_write(new_file, out, head+len-(eol-content));
+            free(out);
+        }
+        free(content);
+        lines[moved[i].id-1] = moved[i].line;
+    }
+    free(new_file);
+
+    // 2) rewrite the catalog, update its indexes, then drop the former files
+    if(res && moved_count) {
+        res = catalog_write(type, lines, count);
+        struct ord_entry* renamed = xmalloc(sizeof(struct ord_entry) * moved_count);
+        for(size_t i = 0; i < moved_count && res; ++i) {
+            renamed[i].name = strchr(moved[i].line, ' ')+1;
+            renamed[i].id = moved[i].id;
+            res = map_add(type, renamed[i].name, renamed[i].id);
+        }
+        if(!res) {
+            // collision directory is rebuilt from the catalog when needed
+            char* map_file = catalog_file(type, MAP_EXT);
+            store_remove(map_file);
+            free(map_file);
+        }
+        res = res && ord_rename(type, to, renamed, moved_count);
+        free(renamed);
+    }
+    for(size_t i = 0; i < moved_count; ++i) {
+        if(res) res = store_remove(moved[i].from_file);
+        free(moved[i].line);
+        free(moved[i].from_file);
+    }
+    free(moved);
+    free(lines);
+    free(buf);
+    return (res)?(int) moved_count:-1;
 }
 
-/* Populate a list with nodes holding names of all elements of given type.
+/* Reduce the catalog lines of the elements that are gone (trashed elements whose file no longer
+ exists included) to their state char.
 */
-int type_retrieve_list(int type, LIST* list) {
-    // obtain type-specific directory
-    char* install_dir = get_install_dir();
-    // allocate path, adding an extra char for slash/separator
-    char* elems_dir = (char*) xmalloc( strlen(install_dir) + strlen(ELEM_DIR[type]) + 2);
-    sprintf(elems_dir, "%s/%s", install_dir, ELEM_DIR[type]);
-
-	struct dirent *ep;
-	char elem_name[ELEM_NAME_MAX];
-	DIR *dp = opendir(elems_dir);	
-	if (!dp) return 0;
-	else {
-		while (ep = readdir(dp)) {
-            // skip current dir and parent dir
-			if(strcmp(ep->d_name, ".") == 0 && strcmp(ep->d_name, "..") == 0) continue;
-
-            // force casting strstr result to boolean
-            if( !trash_flag != !strstr(ep->d_name, ".trash") ) continue;
-            
-            char* elem_file = xmalloc(strlen(elems_dir)+strlen(ep->d_name)+2);
-            sprintf(elem_file, "%s/%s", elems_dir, ep->d_name);
-            FILE* stream;
-            if(stream = fopen(elem_file, "r")) {
-                // read first line
-                if (fgets (elem_name, ELEM_NAME_MAX, stream) == NULL) {
-                    // unable to read from file
-                }
-                else {
-                    // remove the newline char
-                    elem_name[strlen(elem_name)-1] = 0;
-                    NODE* node = xmalloc(sizeof(NODE));
-                    node->str = xmalloc(strlen(elem_name)+1);
-                    strcpy(node->str, elem_name);
-                    list_insert_unique(list, node);
-                }
-                fclose(stream);
-            }
-            free(elem_file);
+static int catalog_compact(int type) {
+    size_t len;
+    char* buf = catalog_read(type, &len);
+    if(buf == NULL) {
+        return 0;
+    }
+    size_t count = 0, size = 256;
+    char** lines = xmalloc(sizeof(char*) * size);
+    char gone[3] = {CAT_GONE, '\n', 0};
+    char* trash_file = xmalloc(strlen(ELEM_DIR[type])+3*FANOUT_MAX+ELEM_NAME_MAX+strlen(ELEM_TRASH)+2);
+    // ids of the elements left in the trash
+    size_t trash_count = 0;
+    uint32_t* trash_ids = xmalloc(sizeof(uint32_t) * size);
+    int changed = 0;
+    for(char* line = buf; line < buf+len; ) {
+        char* eol = strchr(line, '\n');
+        if(!eol) break;
+        *eol = 0;
+        char* name = strchr(line, ' ');
+        int keep = (line[0] == CAT_LIVE);
+        if(line[0] == CAT_TRASH && name && name-line-1 < ELEM_NAME_MAX) {
+            // keep trashed element only if its file is still there
+            *name = 0;
+            elem_path(trash_file, type, line+1, db_config.fanout);
+            strcat(trash_file, ELEM_TRASH);
+            keep = store_exists(trash_file);
+            *name = ' ';
+        }
+        if(count == size) {
+            size *= 2;
+            lines = xrealloc(lines, sizeof(char*) * size);
+            trash_ids = xrealloc(trash_ids, sizeof(uint32_t) * size);
+        }
+        if(keep) {
+            if(line[0] == CAT_TRASH) trash_ids[trash_count++] = count+1;
+            // restore the new line char
+            lines[count] = xmalloc(eol-line+2);
+            sprintf(lines[count++], "%s\n", line);
+        }
+        else {
+            changed = changed || (eol > line+1);
+            lines[count++] = gone;
+        }
+        line = eol+1;
+    }
+    int res = !changed || catalog_write(type, lines, count);
+    // trash index is rewritten without recovered and purged elements
+    char* trs_file = catalog_file(type, TRS_EXT);
+    res = store_write(trs_file, (char*) trash_ids, sizeof(uint32_t) * trash_count) && res;
+    free(trs_file);
+    free(trash_ids);
+    if(changed) {
+        // collision directory and name index are rebuilt without the elements that are gone
+        char* map_file = catalog_file(type, MAP_EXT);
+        store_remove(map_file);
+        free(map_file);
+        char* ord_file = catalog_file(type, ORD_EXT);
+        store_remove(ord_file);
+        free(ord_file);
+    }
+    for(size_t i = 0; i < count; ++i) {
+        if(lines[i] != gone) free(lines[i]);
+    }
+    free(trash_file);
+    free(lines);
+    free(buf);
+    return res;
+}
 
-		}
-		closedir (dp);
-	}
-	free(elems_dir);
+/* data shared by the threads cleaning the files of a type of elements */
+struct clean_data {
+    int type;
+    char** names;
+    size_t count;
+    size_t size;
+    size_t next;            // index of the next file to process
+    int error;
+    pthread_mutex_t lock;
+    CLEAN_STATS* stats;
+    char* peers;            // states of the elements of the other type, by id
+    unsigned int peers_count;
+};
+
+/* Add a file name to the list of files to be cleaned.
+*/
+static int clean_collect(char* name, void* data) {
+    struct clean_data* clean = data;
+    if(clean->count == clean->size) {
+        clean->size = (clean->size)?clean->size*2:256;
+        clean->names = xrealloc(clean->names, sizeof(char*) * clean->size);
+    }
+    clean->names[clean->count++] = xstrdup(name);
     return 1;
 }
 
+/* Clean files until there is none left (or an interruption is requested):
+ files of trashed elements are removed, others are rewritten without removed relations
+ (nor relations to elements that are gone).
+*/
+static void* clean_worker(void* data) {
+    struct clean_data* clean = data;
+    for(;;) {
+        pthread_mutex_lock(&clean->lock);
+        if(interrupt_flag || clean->error || clean->next == clean->count) {
+            pthread_mutex_unlock(&clean->lock);
+            break;
+        }
+        char* name = clean->names[clean->next++];
+        pthread_mutex_unlock(&clean->lock);
+
+        char* elem_file = xmalloc(strlen(ELEM_DIR[clean->type])+strlen(name)+2);
+        sprintf(elem_file, "%s/%s", ELEM_DIR[clean->type], name);
+        long reclaimed = 0;
+        int purged = 0, compacted = 0, res = 1;
+        if(is_trash(name)) {
+            reclaimed = store_size(elem_file);
+            res = store_remove(elem_file);
+            purged = 1;
+        }
+        else {
+            compacted = file_compact(elem_file, ELEM_ADD, clean->peers, clean->peers_count, NULL, 0, NULL, &reclaimed);
+            res = (compacted >= 0);
+        }
+        free(elem_file);
+
+        pthread_mutex_lock(&clean->lock);
+        if(!res) {
+            clean->error = 1;
+        }
+        else {
+            clean->stats->purged += purged;
+            clean->stats->compacted += (compacted > 0);
+            clean->stats->reclaimed += (reclaimed > 0)?reclaimed:0;
+        }
+        ++clean->stats->done;
+        if(verbose_flag && isatty(STDERR_FILENO) && clean->stats->done % 100 == 0) {
+            fprintf(stderr, "\rcleaning %s: %ld/%ld", ELEM_DIR[clean->type], clean->stats->done, clean->stats->total);
+        }
+        pthread_mutex_unlock(&clean->lock);
+    }
+    return NULL;
+}
+
+/* Clean all files of given type, using a pool of threads: trashed elements are purged,
+ and relations logs of live elements are folded (removed relations are dropped, as well as
+ relations to elements of the other type that are gone, i.e. that were purged by a former cleaning).
+ Stops before its end if interrupt_flag gets set (each file is either cleaned or left untouched).
+ Given stats are increased accordingly.
+*/
+int type_clean(int type, CLEAN_STATS* stats) {
+    struct clean_data clean = {type, NULL, 0, 0, 0, 0};
+    clean.stats = stats;
+    if(!inverse_sync(type)) {
+        return 0;
+    }
+    // states of the related elements (relations to deleted elements are kept until they are gone)
+    char** names = catalog_load((type%2)+1, &clean.peers_count, &clean.peers);
+    catalog_free(names, clean.peers_count);
+    if(!names || !store_scan((char*) ELEM_DIR[type], clean_collect, &clean)) {
+        free(clean.peers);
+        return 0;
+    }
+    stats->total += clean.count;
+    pthread_mutex_init(&clean.lock, NULL);
+
+    // one thread per processor (if storage allows it)
+    long threads_count = (store_concurrent())?sysconf(_SC_NPROCESSORS_ONLN):1;
+    if(threads_count > CLEAN_THREADS_MAX) threads_count = CLEAN_THREADS_MAX;
+    if(threads_count > (long) clean.count) threads_count = clean.count;
+    if(threads_count < 1) threads_count = 1;
+    pthread_t threads[CLEAN_THREADS_MAX];
+    long started = 0;
+    for(; started < threads_count; ++started) {
+        if(pthread_create(&threads[started], NULL, clean_worker, &clean) != 0) break;
+    }
+    if(!started) {
+        // no thread available : do the job in current one
+        clean_worker(&clean);
+    }
+    for(long i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    if(verbose_flag && isatty(STDERR_FILENO) && clean.stats->done >= 100) {
+        fprintf(stderr, "\rcleaning %s: %ld/%ld\n", ELEM_DIR[type], stats->done, stats->total);
+    }
+    pthread_mutex_destroy(&clean.lock);
+
+    for(size_t i = 0; i < clean.count; ++i) {
+        free(clean.names[i]);
+    }
+    free(clean.names);
+    free(clean.peers);
+    // catalog reflects the files that were actually purged (even if interrupted)
+    return catalog_compact(type) && !clean.error;
+}
+
 /* Populate a list with nodes holding strings matching the given wildcard
  List content depends on given type:
  ELEM_FILE: absolute filenames matching wildcard
  ELEM_TAG:  tag names matching wildcard
- (this function calls list_insert_unique, which avoid duplicates)
+ (this function calls list_insert, which avoid duplicates)
 */
 int glob_retrieve_list(int glob_type, int elem_type, char *wildcard, LIST* list) {
     if(glob_type == GLOB_FS) {
@@ -306,38 +3051,38 @@ int glob_retrieve_list(int glob_type, int elem_type, char *wildcard, LIST* list)
         for(int i = result.gl_offs; result.gl_pathv[i]; ++i) {
             // retrieve full filepath of each file
             filepath = get_path(result.gl_pathv[i]);
-            NODE* node = xmalloc(sizeof(NODE));
-            node->str = xmalloc(strlen(filepath)+1);
-            strcpy(node->str, filepath);
             // insert filenames into a list (best effort: no error check here)
-            list_insert_unique(list, node);
+            char* str = xstrdup(filepath);
+            if(list_insert(list, 0, str) != 1) {
+                free(str);
+            }
         }
         globfree(&result);
     }
     else {
         LIST* temp_list = (LIST*) xzalloc(sizeof(LIST));
-        temp_list->first = (NODE*) xzalloc(sizeof(NODE));
-        // retrieve all tags
-        if( !type_retrieve_list(elem_type, temp_list)) {
+        // elements whose name starts with the literal part of the wildcard (ex.: directory of
+        // files, or 'music/' for tags) are read from the name index, otherwise all elements are retrieved
+        // (trashed elements are all read from the trash index)
+        size_t prefix_len = strcspn(wildcard, "*?[");
+        int ranged = (!trash_flag && prefix_len && ord_range(elem_type, wildcard, prefix_len, CAT_LIVE, temp_list));
+        if( !ranged && !type_retrieve_list(elem_type, temp_list)) {
            return 0;
         }
         // keep only elements having name matching wildcard
-        NODE* ptr = temp_list->first;
-        while(ptr->next) {
-            if(fnmatch(wildcard, ptr->next->str, FNM_NOESCAPE) == FNM_NOMATCH) {
+        int kept = 0;
+        for(int i = 0; i < temp_list->count; ++i) {
+            if(fnmatch(wildcard, temp_list->nodes[i].str, FNM_NOESCAPE) == FNM_NOMATCH) {
                 // remove non-matching elem
-                NODE* temp = ptr->next;
-                ptr->next = temp->next;
-                free(temp->str);
-                free(temp);			
-                --temp_list->count;                
+                free(temp_list->nodes[i].str);
             }
-            else ptr = ptr->next;
-            if(!ptr) break;            
+            else temp_list->nodes[kept++] = temp_list->nodes[i];
         }
+        temp_list->count = kept;
         // store result into target list
-        list_merge(list, temp_list);      
+        list_merge(list, temp_list);
         list_free(temp_list);
+        free(temp_list);
     }
     return 1;
 }
@@ -346,11 +3091,12 @@ int glob_retrieve_list(int glob_type, int elem_type, char *wildcard, LIST* list)
 type specifies the type of elements pointed by elems list
 */
 int list_retrieve_list(int type, LIST* elems, LIST* list) {    
-    NODE* ptr = elems->first;
-    while(ptr->next) {
+    list_sort(elems);
+    for(int i = 0; i < elems->count; ++i) {
+        NODE* node = &elems->nodes[i];
         // retrieve files related to current tag
         ELEM elem_related;
-        int res = elem_init(type, ptr->next->str, &elem_related, 0);
+        int res = (node->id)?elem_get(type, node->id, &elem_related):elem_open(type, node->str, &elem_related, 0);
         if( res <= 0) {
             // error : non-existing tag or reading error
             return 0;
@@ -360,7 +3106,214 @@ int list_retrieve_list(int type, LIST* elems, LIST* list) {
             // error while retrieving list from file
             return 0;                        
         }
-        ptr = ptr->next;
     }
     return 1;
 }
+
+
+/* Write an element and its relations to the export stream.
+*/
+static int export_elem(char* name, void* data) {
+    struct scan_data* scan = data;
+    if( !scan->trash != !is_trash(name) ) return 1;
+
+    char* elem_file = xmalloc(strlen(ELEM_DIR[scan->type])+strlen(name)+2);
+    sprintf(elem_file, "%s/%s", ELEM_DIR[scan->type], name);
+    size_t len;
+    char* buf = store_map(elem_file, &len);
+    free(elem_file);
+    if(buf == NULL) {
+        return 0;
+    }
+    size_t name_len = strcspn(buf, "\n");
+    // element line: type (uppercase for live elements, lowercase for trashed ones) and name
+    char type = (scan->type == ELEM_TAG)?'T':'F';
+    fprintf(scan->stream, "%c %.*s\n", scan->trash?tolower(type):type, (int) name_len, buf);
+    if(!scan->names) {
+        // relation lines hold names (database created by a former version) : output them as they are
+        char* body = buf + name_len;
+        if(*body) ++body;
+        fputs(body, scan->stream);
+    }
+    else {
+        // relation lines hold ids (block might be packed) : output the names of the related elements
+        // (a relation to a trashed element is marked as such, since a live element may have the same name)
+        size_t count, tail;
+        RELATION* rels = elem_fold(buf, &count, &tail);
+        for(size_t i = 0; i < count; ++i) {
+            unsigned int id = rels[i].id;
+            if(id && id <= scan->names_count && scan->names[id]) {
+                char state = (rels[i].state == ELEM_ADD && scan->states[id] == CAT_TRASH)?CAT_TRASH:rels[i].state;
+                fprintf(scan->stream, "%c%s\n", state, scan->names[id]);
+            }
+        }
+        free(rels);
+    }
+    store_unmap(buf, len);
+    return !ferror(scan->stream);
+}
+
+/* Write all elements of given type (including trashed ones), along with their relations, to a stream.
+ Stream consists of lines holding either an element ('T name', 'F name', or 't name', 'f name' for 
+ trashed elements) or a relation of the preceding element ('+name' or '-name', or '~name' for a
+ relation to a trashed element).
+ Trashed elements come first, so that a live element and a trashed one can share the same name.
+*/
+int elem_export(int type, FILE* stream) {
+    struct scan_data scan = {type, 1, NULL, stream, 0, NULL, 0, NULL};
+    if(!inverse_sync(type)) {
+        return 0;
+    }
+    if(strcmp(db_config.relations, RELATIONS_NAMES) != 0) {
+        // names of related elements, by id
+        scan.names = catalog_load((type%2)+1, &scan.names_count, &scan.states);
+        if(!scan.names) {
+            return 0;
+        }
+    }
+    int res = store_scan((char*) ELEM_DIR[type], export_elem, &scan);
+    if(res) {
+        scan.trash = 0;
+        res = store_scan((char*) ELEM_DIR[type], export_elem, &scan);
+    }
+    catalog_free(scan.names, scan.names_count);
+    free(scan.states);
+    return res;
+}
+
+/* element created by elem_import */
+struct import_entry {
+    char* name;
+    unsigned int id;
+    int trash;
+};
+
+/* Compare two imported elements by name (live element first).
+*/
+static int import_cmp(const void* a, const void* b) {
+    const struct import_entry* entry1 = a;
+    const struct import_entry* entry2 = b;
+    int cmp = strcmp(entry1->name, entry2->name);
+    return (cmp)?cmp:(entry1->trash - entry2->trash);
+}
+
+/* Find the id of the imported element having given name (preferably a live one, unless trash is set).
+*/
+static unsigned int import_find(struct import_entry* entries, size_t count, char* name, int trash) {
+    // lower bound : first entry by that name
+    size_t lo = 0, hi = count;
+    while(lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if(strcmp(entries[mid].name, name) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    if(trash && lo+1 < count && !entries[lo].trash && strcmp(entries[lo+1].name, name) == 0) ++lo;
+    return (lo < count && strcmp(entries[lo].name, name) == 0)?entries[lo].id:0;
+}
+
+/* Create all elements read from a stream (as written by elem_export) in current database.
+ Elements are created in a first pass, so that relations (read in a second pass) can be
+ translated to the ids of the related elements.
+ Returns the number of imported elements, or -1 on error.
+*/
+int elem_import(FILE* stream) {
+    int count = 0;
+    char line[ELEM_NAME_MAX+3];
+    // files of the imported elements, in stream order (NULL for elements already present)
+    char** files = NULL;
+    size_t files_size = 0;
+    // imported elements of each type
+    struct import_entry* entries[3] = {NULL, NULL, NULL};
+    size_t entries_count[3] = {0, 0, 0}, entries_size[3] = {0, 0, 0};
+    int res = 1;
+
+    // 1) create elements
+    while(res && fgets(line, sizeof(line), stream)) {
+        if(line[0] == ELEM_ADD || line[0] == ELEM_REM || line[0] == CAT_TRASH) continue;
+        line[strcspn(line, "\n")] = 0;
+        int type = (toupper(line[0]) == 'T')?ELEM_TAG:ELEM_FILE;
+        int trash = islower(line[0]);
+        if((size_t) count == files_size) {
+            files_size = (files_size)?files_size*2:256;
+            files = xrealloc(files, sizeof(char*) * files_size);
+        }
+        files[count] = NULL;
+        ELEM elem;
+        int created = elem_open(type, line+2, &elem, 0);
+        if(created == 0) {
+            created = elem_open(type, line+2, &elem, 1);
+            res = (created == 2) && (!trash || elem_trash(&elem));
+            if(res) {
+                if(entries_count[type] == entries_size[type]) {
+                    entries_size[type] = (entries_size[type])?entries_size[type]*2:256;
+                    entries[type] = xrealloc(entries[type], sizeof(struct import_entry) * entries_size[type]);
+                }
+                struct import_entry* entry = &entries[type][entries_count[type]++];
+                entry->name = elem.name;
+                entry->id = elem.id;
+                entry->trash = trash;
+                files[count] = elem.file;
+                if(trash) {
+                    // file has been renamed
+                    files[count] = xrealloc(elem.file, strlen(elem.file)+strlen(ELEM_TRASH)+1);
+                    strcat(files[count], ELEM_TRASH);
+                }
+            }
+        }
+        else {
+            // element already exists
+            res = (created > 0);
+        }
+        ++count;
+    }
+    for(int type = ELEM_TAG; type <= ELEM_FILE; ++type) {
+        qsort(entries[type], entries_count[type], sizeof(struct import_entry), import_cmp);
+    }
+
+    // 2) append relations to the files of the created elements
+    char* buf = NULL;
+    size_t len = 0, size = 0;
+    int i = -1, type = 0;
+    rewind(stream);
+    while(res) {
+        int eof = !fgets(line, sizeof(line), stream);
+        if(eof || (line[0] != ELEM_ADD && line[0] != ELEM_REM && line[0] != CAT_TRASH)) {
+            // new element : flush relations of the previous one
+            if(i >= 0 && files[i] && len) {
+                // relations are appended as a log, then sorted
+                res = store_append(files[i], buf, len) && file_compact(files[i], 0, NULL, 0, NULL, 0, NULL, NULL) >= 0;
+            }
+            if(eof) break;
+            type = (toupper(line[0]) == 'T')?ELEM_TAG:ELEM_FILE;
+            ++i;
+            len = 0;
+        }
+        else if(i >= 0 && files[i]) {
+            line[strcspn(line, "\n")] = 0;
+            int related = (type%2)+1;
+            int trash = (line[0] == CAT_TRASH);
+            unsigned int id = import_find(entries[related], entries_count[related], line+1, trash);
+            if(id) {
+                char rel[16];
+                sprintf(rel, "%c%u\n", (trash)?ELEM_ADD:line[0], id);
+                buf_append(&buf, &len, &size, rel);
+            }
+        }
+    }
+    free(buf);
+    for(int j = 0; j < count; ++j) {
+        free(files[j]);
+    }
+    free(files);
+    for(int t = ELEM_TAG; t <= ELEM_FILE; ++t) {
+        for(size_t j = 0; j < entries_count[t]; ++j) {
+            free(entries[t][j].name);
+        }
+        free(entries[t]);
+        // relations counts are computed again from the imported files
+        char* cnt_file = catalog_file(t, CNT_EXT);
+        store_remove(cnt_file);
+        free(cnt_file);
+    }
+    return (res)?count:-1;
+}
@@ -8,6 +8,8 @@
 #ifndef ELEM_H
 #define ELEM_H 1
 
+#include <stdio.h>
+
 #include "list.h"
 
 #define ELEM_TAG    1
@@ -18,40 +20,195 @@
 
 #define ELEM_ADD   '+'
 #define ELEM_REM   '-'
+#define ELEM_ID    '#'
+#define ELEM_BLOOM '%'
+#define ELEM_SKIP  '@'
 
 #define ELEM_NAME_MAX 1024
 
+/* relations of an element file are kept in a sorted block of fixed-size records ('+0000000012\n'),
+ followed by a short log of unsorted lines */
+#define REL_DIGITS      10
+#define REL_SIZE        (REL_DIGITS+2)
+#define REL_TAIL_MAX    64
+
+/* blocks of at least REL_PACK_MIN records are packed : ids are delta-encoded as varints,
+ written with the chars of REL_PACK_DIGITS */
+#define REL_PACK_MIN    1024
+#define REL_PACK_DIGITS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+
+/* packed blocks are split into segments of REL_SEGMENT records, listed in a skip table, so that
+ a segment can be decoded without decoding the ones before it */
+#define REL_SEGMENT     1024
+
+/* Bloom filter of the ids related to an element (hex digits, size is a power of 2) */
+#define BLOOM_HASHES    3
+#define BLOOM_BITS_MIN  64
+#define BLOOM_BITS_MAX  16384
+#define BLOOM_BITS_REL  10          // bits per relation
+
+/* extension given to the files of trashed elements */
+#define ELEM_TRASH  ".trash"
+
+/* extension of the catalog of each type of elements (ex.: tags.cat), of its index (ex.: tags.idx),
+ and of its collision directory (ex.: tags.map) */
+#define CAT_EXT     ".cat"
+#define IDX_EXT     ".idx"
+#define MAP_EXT     ".map"
+
+/* extension of the name index of each type of elements (ex.: files.ord) */
+#define ORD_EXT     ".ord"
+
+/* count of elements added since the name index was built, above which it is rebuilt */
+#define ORD_TAIL_MAX    1024
+
+/* extension of the trash index of each type of elements (ex.: files.trs) */
+#define TRS_EXT     ".trs"
+
+/* extension of the relations counts of each type of elements (ex.: tags.cnt) */
+#define CNT_EXT     ".cnt"
+
+/* above this count of relations counts to update, the whole counts file is rewritten */
+#define CNT_PATCH_MAX   64
+
+/* minimum count of slots of a collision directory (power of 2) */
+#define MAP_SLOTS_MIN   1024
+
+/* formats of the relation lines (value of the 'relations' setting of a database) */
+#define RELATIONS_NAMES "names"     // '+name' (databases created by former versions)
+#define RELATIONS_IDS   "ids"       // '+id'
+
+/* ways of keeping the relations of files (value of the 'inverse' setting of a database) */
+#define INVERSE_SYNC    "sync"      // files and tags are updated at once
+#define INVERSE_LAZY    "lazy"      // tags are updated, changes of files are journaled (see elem_sync_inverse)
+
+/* extension of the journal of the relation changes pending for files (ex.: files.inv) */
+#define INV_EXT     ".inv"
+
+/* above this count of ids to resolve, the whole catalog is read at once instead of one line per id */
+#define CAT_LOOKUP_MAX  64
+
+/* states of the elements listed in a catalog */
+#define CAT_LIVE    '+'
+#define CAT_TRASH   '~'
+#define CAT_GONE    '-'
+
+/* front coding of the names listed in a catalog : a name sharing at least CAT_SHARED_MIN leading chars
+ with the name of the previous line is stored as the count of shared chars and the remaining chars
+ (ex.: '+0cc175b9c0f1b6a831c399e269772661=21 b.mp3'), and every CAT_RESTART lines the full name is stored */
+#define CAT_SHARED      '='
+#define CAT_SHARED_MIN  4
+#define CAT_RESTART     16
+
+
+/* maximum number of threads used for cleaning database */
+#define CLEAN_THREADS_MAX   16
+
 
 typedef struct elem {
     int type;
+    unsigned int id;
     char* name;
     char* file;
 } ELEM;
 
+/* relation changes collected for being applied at once (see batch_relate) */
+typedef struct batch BATCH;
+
+/* counters of a cleaning pass */
+typedef struct clean_stats {
+    long total;         // files to process
+    long done;          // files processed
+    long compacted;     // rewritten files
+    long purged;        // removed files of trashed elements
+    long reclaimed;     // bytes saved
+} CLEAN_STATS;
 
-/* Check if a file matches a given element name */
-int check_file(char* elem_name, char* file_name);
 
 /* Find the hashed filename (with full path) associated to an element (tag or file). */
 char* resolve_name(int type, char* elem_name);
 
-/* Look into specified file for a line matching given name, and if it already exists set it to new status. */
-int update_record(char status, char* file, char* name);
+/* Retrieve an element using its name as stored in the database. */
+int elem_open(int type, char* name, ELEM* el, int flag_create);
 
+/* Retrieve an element using a name given by user. */
 int elem_init(int type, char* name, ELEM* el, int flag_create);
 
+/* Retrieve an element using its id. */
+int elem_get(int type, unsigned int id, ELEM* el);
+
+/* Create or suppress a relation from given element to another (one side only). */
+int elem_link(char action, ELEM* elem, unsigned int id);
+
 /* Create or suppress a symetrical relation between given elements. */
 int elem_relate(char action, ELEM* elem1, ELEM* elem2);
 
+/* Allocate an empty batch of relation changes. */
+BATCH* batch_new();
+
+/* Record the creation or suppression of a symetrical relation between given elements. */
+int batch_relate(BATCH* batch, char action, ELEM* elem1, ELEM* elem2);
+
+/* Apply all changes of a batch, with a single rewrite of each element file. */
+int batch_commit(BATCH* batch);
+
+/* Release a batch of relation changes (changes that were not committed are lost). */
+void batch_free(BATCH* batch);
+
+/* Move an element to the trash. */
+int elem_trash(ELEM* elem);
+
+/* Restore a previously trashed element. */
+int elem_recover(int type, char* name, ELEM* el);
+
 /* Populate a list with nodes holding names of the elements pointed by the given element. */
 int elem_retrieve_list(ELEM* elem, LIST* list);
 
+/* Populate a list with nodes holding names of all the elements ever related to the given element. */
+int elem_retrieve_all(ELEM* elem, LIST* list);
+
+/* Keep only the nodes of a list holding ids of elements related to the given element. */
+int elem_filter_list(ELEM* elem, LIST* list);
+
+/* Merge the relations tail of an element into its sorted block (one record per related element). */
+int elem_compact(ELEM* elem);
+
+/* Obtain the count of live elements related to given element. */
+long elem_count(ELEM* elem);
+
+/* Append the count of live related elements to the names held by a list of elements of given type. */
+int elem_count_list(int type, LIST* list);
+
+/* Apply the relation changes journaled for files (databases having the 'lazy' inverse setting). */
+int elem_sync_inverse(void);
+
+/* Complete the command that was interrupted by a crash, if any. */
+int elem_sync_journal(void);
+
 /* Populate a list with nodes holding names of all elements of given type. */
 int type_retrieve_list(int type, LIST* list);
 
+/* Replace the ids held by a list of elements of given type with the names of the elements. */
+int elem_resolve_list(int type, LIST* list);
+
+/* Purge trashed elements and fold the relations logs of all elements of given type. */
+int type_clean(int type, CLEAN_STATS* stats);
+
+/* Move all files of given type to the location they have with given fan-out. */
+int type_relocate(int type, int fanout);
+
+/* Rename all elements of given type whose name starts with given path, replacing that path. */
+int type_move(int type, char* from, char* to, int* ignored);
+
 /* Populate a list with nodes matching the given wildcard. */
 int glob_retrieve_list(int glob_type, int elem_type, char *wildcard, LIST* list);
 
 /* Populate a destination list with nodes holding values of elements related to those in given list. */
 int list_retrieve_list(int type, LIST* elems, LIST* list);
+
+/* Write all elements of given type, along with their relations, to a stream. */
+int elem_export(int type, FILE* stream);
+
+/* Create all elements read from a stream in current database. */
+int elem_import(FILE* stream);
 #endif
\ No newline at end of file
@@ -15,7 +15,9 @@
 #include <unistd.h>
 
 #include "xalloc.h"
+#include "hash.h"
 #include "elem.h"
+#include "store.h"
 #include "env.h"
 #include "error.h"
 
@@ -29,6 +31,14 @@ extern char DB_CHARSET[32];
 
 const char* ELEM_DIR[] = {"", "tags", "files"};
 
+/* Settings of the current database.
+ Default values are the ones of a database created before settings were introduced.
+*/
+CONFIG db_config = {STORE_DIR, 0, RELATIONS_NAMES, HASH_MD5, INVERSE_SYNC, "", 0};
+
+/* Path of the install dir (computed once, see get_install_dir) */
+static char install_dir[FILENAME_MAX] = "";
+
 /* Define a constant holding an identifier of the current system.
 */
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
@@ -74,6 +84,9 @@ char* absolute_path(char* filename) {
 char* relative_path(char* filename) {
     static char relative_name[FILENAME_MAX];
     char* absolute_name = absolute_path(filename);
+    if(!absolute_name) {
+        return NULL;
+    }
     char reference_name[FILENAME_MAX];
 // todo : use ENV_DIR as reference
     getcwd(reference_name, FILENAME_MAX);
@@ -118,7 +131,6 @@ char* get_path(char* filename) {
 /* Retrieve the installation directory (ex.:[user homedir]/.tagger)
 */
 char* get_install_dir() {
-    static char install_dir[FILENAME_MAX] = "";
     // compute install dir only once
     if(strlen(install_dir) == 0) {
         if(!strcasecmp(ENV_PATH, "home")) {
@@ -159,18 +171,109 @@ char* get_install_dir() {
     return install_dir;
 }
 
+/* Force the install dir to a given path (used when migrating to a new database).
+*/
+void set_install_dir(char* path) {
+    strcpy(install_dir, path);
+}
+
+/* Load database settings from the config file of the install dir.
+ Each line of the file holds a 'key=value' pair. Unknown keys are ignored.
+ If there is no config file, settings are left unchanged.
+*/
+int read_config(CONFIG* config) {
+    char* main_dir = get_install_dir();
+    char* config_file = xmalloc(strlen(main_dir)+strlen(CONFIG_FILE)+2);
+    sprintf(config_file, "%s%s%s", main_dir, PATH_SEPARATOR, CONFIG_FILE);
+    FILE* fp = fopen(config_file, "r");
+    free(config_file);
+    if(fp == NULL) {
+        return 0;
+    }
+    char line[FILENAME_MAX];
+    while(fgets(line, FILENAME_MAX, fp)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char* value = strchr(line, '=');
+        if(line[0] == '#' || !value) continue;
+        *value++ = 0;
+        if(!strcmp(line, "backend") && strlen(value) < sizeof(config->backend)) {
+            strcpy(config->backend, value);
+        }
+        else if(!strcmp(line, "fanout") && atoi(value) >= 0 && atoi(value) <= FANOUT_MAX) {
+            config->fanout = atoi(value);
+        }
+        else if(!strcmp(line, "relations") && strlen(value) < sizeof(config->relations)) {
+            strcpy(config->relations, value);
+        }
+        else if(!strcmp(line, "hash") && strlen(value) < sizeof(config->hash)) {
+            strcpy(config->hash, value);
+        }
+        else if(!strcmp(line, "inverse") && strlen(value) < sizeof(config->inverse)) {
+            strcpy(config->inverse, value);
+        }
+        else if(!strcmp(line, "roots") && strlen(value) < sizeof(config->roots)) {
+            strcpy(config->roots, value);
+        }
+        else if(!strcmp(line, "version")) {
+            config->version = atoi(value);
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Save database settings into the config file of the install dir.
+*/
+int write_config(CONFIG* config) {
+    char* main_dir = get_install_dir();
+    char* config_file = xmalloc(strlen(main_dir)+strlen(CONFIG_FILE)+2);
+    sprintf(config_file, "%s%s%s", main_dir, PATH_SEPARATOR, CONFIG_FILE);
+    FILE* fp = fopen(config_file, "w");
+    free(config_file);
+    if(fp == NULL) {
+        return 0;
+    }
+    fprintf(fp, "# tagger database settings\n");
+    fprintf(fp, "version=%d\n", config->version);
+    fprintf(fp, "backend=%s\n", config->backend);
+    fprintf(fp, "fanout=%d\n", config->fanout);
+    fprintf(fp, "relations=%s\n", config->relations);
+    fprintf(fp, "hash=%s\n", config->hash);
+    fprintf(fp, "inverse=%s\n", config->inverse);
+    fprintf(fp, "roots=%s\n", config->roots);
+    fclose(fp);
+    return 1;
+}
+
 
 int check_env() {
     int result = 0;
     char* main_dir = get_install_dir();
+    if(!opendir(main_dir)) {
+        return 0;
+    }
+    read_config(&db_config);
+    if(!hash_select(db_config.hash)) {
+        // unknown hash function
+        return 0;
+    }
+    if(db_config.version < DB_VERSION && !strcmp(db_config.relations, RELATIONS_IDS)) {
+        // catalogs of former versions are read as is, and new lines are front-coded
+        db_config.version = DB_VERSION;
+        write_config(&db_config);
+    }
+    if(!strcmp(db_config.backend, STORE_PACK)) {
+        // all elements are stored in a single file
+        return store_open(0);
+    }
     // allocate paths, adding an extra char for slash/separator
     char* files_dir = xmalloc(strlen(main_dir)+strlen(ELEM_DIR[ELEM_FILE])+2);
     char* tags_dir = xmalloc(strlen(main_dir)+strlen(ELEM_DIR[ELEM_TAG])+2);
     sprintf(files_dir, "%s%s%s", main_dir, PATH_SEPARATOR, ELEM_DIR[ELEM_FILE]);
     sprintf(tags_dir, "%s%s%s", main_dir, PATH_SEPARATOR, ELEM_DIR[ELEM_TAG]);
 
-    if(opendir(main_dir) && opendir(files_dir) && opendir(tags_dir)) {
-        result = 1;
+    if(opendir(files_dir) && opendir(tags_dir)) {
+        result = store_open(0);
     }
 
     free(files_dir);
@@ -190,6 +293,16 @@ int setup_env() {
             return 0;
         }
     }
+    // new database : stamp current format version
+    db_config.version = DB_VERSION;
+    if(!hash_select(db_config.hash) || !write_config(&db_config)) {
+        return 0;
+    }
+    if(!strcmp(db_config.backend, STORE_PACK)) {
+        // create the pack file
+        free(sub_dir);
+        return store_open(1);
+    }
     // create sub directories if missing
     sprintf(sub_dir, "%s%s%s", install_dir, PATH_SEPARATOR, ELEM_DIR[ELEM_FILE]);
     if(!(dp = opendir(sub_dir))) {
@@ -206,5 +319,5 @@ int setup_env() {
         }
     }
     free(sub_dir);
-    return 1;
+    return store_open(1);
 }
@@ -22,6 +22,34 @@
 */
 #define FILENAME_MAX 1024
 
+/* Name of the file holding the database settings, inside the install dir. */
+#define CONFIG_FILE "config"
+
+/* Version of the database format (stamped in the config file of new databases).
+ Databases created before the stamp was introduced have version 0.
+ Version 2 : names in catalogs are front-coded (catalogs of former versions remain readable).
+ Version 3 : large relations blocks are packed (blocks of former versions remain readable).
+*/
+#define DB_VERSION 3
+
+/* Database settings
+ (set at 'init' time and stored in the install dir, changed with 'migrate')
+*/
+typedef struct config {
+    char backend[8];        // STORE_DIR or STORE_PACK
+    int  fanout;            // levels of sub-directories for element files (0 to FANOUT_MAX)
+    char relations[8];      // RELATIONS_NAMES or RELATIONS_IDS
+    char hash[8];           // HASH_MD5 or HASH_MURMUR3
+    char inverse[8];        // INVERSE_SYNC or INVERSE_LAZY
+    char roots[FILENAME_MAX];   // extra storage roots element files are spread among (see store.c), separated with ':'
+    int  version;           // DB_VERSION of the program that created the database
+} CONFIG;
+
+/* Max levels of fan-out sub-directories (each level uses 2 chars of the element hash) */
+#define FANOUT_MAX 4
+
+/* settings of the current database (defined in env.c) */
+extern CONFIG db_config;
 
 /* Convert a path string according to current environment.
 */
@@ -38,6 +66,15 @@ char* get_path(char* filename);
 
 char* get_install_dir();
 
+/* Force the install dir to a given path. */
+void set_install_dir(char* path);
+
+/* Load database settings from the install dir. */
+int read_config(CONFIG* config);
+
+/* Save database settings into the install dir. */
+int write_config(CONFIG* config);
+
 int check_env();
 
 int setup_env();
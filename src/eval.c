@@ -13,6 +13,7 @@
 #include "xalloc.h"
 #include "list.h"
 #include "elem.h"
+#include "store.h"
 #include "error.h"
 
 /* Check if given string matches query syntax or if it is a single tag name 
@@ -227,8 +228,23 @@ char* next_operand(char* str, char** saveptr) {
     return result;
 }
 
+/* Retrieve the list of files related to a tag operand.
+*/
+static LIST* operand_list(ELEM* el_tag) {
+    LIST* list = (LIST*) xzalloc(sizeof(LIST));
+    if(elem_retrieve_list(el_tag, list) < 0) {
+        raise_error(ERROR_ENV,
+                    "%s:%d - Unexpected error occured while retrieving list from file '%s'",
+                    __FILE__, __LINE__, el_tag->file);
+    }
+    return list;
+}
+
 /* Evaluates a query string and returns the list of mathching files.
 This function calls postfix_convert to convert query in RPN and then implements postfix algorithm.
+Lists of tag operands are retrieved only when needed: the 'and' of two operands retrieves the list
+of the smaller tag only (as told by the relations counts), which is then filtered with the relations
+of the other one (see elem_filter_list).
 
 Reserved chars/separators are: [space], [parentheses], [ampercent], [more], [not]
 If a tagname contains reserved chars it should be escaped with brackets.
@@ -238,6 +254,8 @@ LIST* eval(char* query) {
     char *ptr, *operand;
     char postfix[256];
     LIST* stack_list[64];
+    // tag operands whose list is not retrieved yet (stack_list holds NULL for them)
+    ELEM stack_elem[64];
     
     int stack_list_count = 0;
 
@@ -251,10 +269,7 @@ LIST* eval(char* query) {
         if(postfix[i] == 'x') {
             // if current token is an operand,
             // use last extracted operand from original query string
-            // and store its related list into stack_list
-            LIST* new_list = (LIST*) xzalloc(sizeof(LIST));
-            new_list->first = (NODE*) xzalloc(sizeof(NODE));
-            
+            // and store it into stack_list (its related list is retrieved when needed)
             ELEM el_tag;
             int res = elem_init(ELEM_TAG, operand, &el_tag, 0);
             if( res < 0) {
@@ -265,14 +280,9 @@ LIST* eval(char* query) {
             else if(!res) {
                 raise_error(ERROR_USAGE, "Tag '%s' does not exist.", operand);
             }
-            
-            if(elem_retrieve_list(&el_tag, new_list) < 0) {
-                raise_error(ERROR_ENV,
-                            "%s:%d - Unexpected error occured while retrieving list from file '%s'",
-                            __FILE__, __LINE__, el_tag.file);
-            }	            
-            stack_list[stack_list_count] = new_list;
-            ++stack_list_count;            
+            stack_elem[stack_list_count] = el_tag;
+            stack_list[stack_list_count] = NULL;
+            ++stack_list_count;
             // extract next operand
             operand = next_operand(NULL, &ptr);
         }
@@ -283,9 +293,11 @@ LIST* eval(char* query) {
                 // we need at minimum one list on stack_list
                 return NULL;
             }
+            if(!stack_list[stack_list_count-1]) {
+                stack_list[stack_list_count-1] = operand_list(&stack_elem[stack_list_count-1]);
+            }
             LIST* op_list = stack_list[stack_list_count-1];
             LIST* new_list = (LIST*) xzalloc(sizeof(LIST));
-            new_list->first = (NODE*) xzalloc(sizeof(NODE));
 
             // retrieve all tagged files
             if( !type_retrieve_list(ELEM_FILE, new_list)) {
@@ -305,11 +317,42 @@ LIST* eval(char* query) {
             if(stack_list_count <= 1) {
                 return NULL;
             }
-            LIST* list1 = stack_list[stack_list_count-2];            
-            LIST* list2 = stack_list[stack_list_count-1];            
-			list_intersect(list1, list2);
-            list_free(list2);
-            --stack_list_count;            
+            int i1 = stack_list_count-2, i2 = stack_list_count-1;
+            if(!stack_list[i1] && !stack_list[i2]) {
+                // two tag operands : retrieve the list of the smaller one
+                // (sizes of the files are compared if counts cannot be read)
+                long size1 = elem_count(&stack_elem[i1]), size2 = elem_count(&stack_elem[i2]);
+                if(size1 < 0 || size2 < 0) {
+                    size1 = store_size(stack_elem[i1].file);
+                    size2 = store_size(stack_elem[i2].file);
+                }
+                if(size1 <= size2) {
+                    stack_list[i1] = operand_list(&stack_elem[i1]);
+                }
+                else {
+                    stack_list[i1] = operand_list(&stack_elem[i2]);
+                    stack_elem[i2] = stack_elem[i1];
+                }
+            }
+            else if(!stack_list[i1]) {
+                // keep the tag operand on top
+                stack_list[i1] = stack_list[i2];
+                stack_list[i2] = NULL;
+                stack_elem[i2] = stack_elem[i1];
+            }
+            if(!stack_list[i2]) {
+                // filter the list with the relations of the tag
+                if(elem_filter_list(&stack_elem[i2], stack_list[i1]) < 0) {
+                    raise_error(ERROR_ENV,
+                                "%s:%d - Unexpected error occured while retrieving list from file '%s'",
+                                __FILE__, __LINE__, stack_elem[i2].file);
+                }
+            }
+            else {
+                list_intersect(stack_list[i1], stack_list[i2]);
+                list_free(stack_list[i2]);
+            }
+            --stack_list_count;
         }
         if(postfix[i] == '|') {
             // if current token is 'or' operator
@@ -317,6 +360,9 @@ LIST* eval(char* query) {
             if(stack_list_count <= 1) {
                 return NULL;
             }
+            for(int j = stack_list_count-2; j < stack_list_count; ++j) {
+                if(!stack_list[j]) stack_list[j] = operand_list(&stack_elem[j]);
+            }
             LIST* list1 = stack_list[stack_list_count-2];            
             LIST* list2 = stack_list[stack_list_count-1];            
 			list_merge(list1, list2);
@@ -327,5 +373,8 @@ LIST* eval(char* query) {
     if(stack_list_count != 1) {
         return NULL;
     }
+    if(!stack_list[0]) {
+        stack_list[0] = operand_list(&stack_elem[0]);
+    }
     return stack_list[0];
 }
\ No newline at end of file
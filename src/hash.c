@@ -8,23 +8,140 @@
 
 #include <stdio.h>
 #include <string.h>
-#include "md5.h"   
+#include <stdint.h>
+#include "md5.h"
 #include "hash.h"
 
-/* Return a 32 characters hash of the given string. 
- This function uses the Alexander Peslyak OpenSSL-compatible implementation 
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+/* Write the hex representation of a 16 bytes digest (32 chars and a null char).
+*/
+static void hash_hex(unsigned char* digest, char* result) {
+    for(int i = 0; i < 16; ++i) {
+        result[i*2] = HEX_DIGITS[digest[i] >> 4];
+        result[i*2+1] = HEX_DIGITS[digest[i] & 0x0f];
+    }
+    result[32] = 0;
+}
+
+/* Return a 32 characters hash of the given string.
+ This function uses the Alexander Peslyak OpenSSL-compatible implementation
  of MD5 Algorithm (RFC 1321) to generate a MD5 digest.
 */
-char* hash(char* str) {
+static char* hash_md5(char* str) {
     MD5_CTX context;
     unsigned char digest[16];
     static char result[33];
     MD5_Init(&context);
     MD5_Update(&context, str, strlen(str));
     MD5_Final(digest, &context);
-    for(int i = 0; i < 16; ++i) {
-        sprintf(&result[i*2], "%02x", (unsigned int) digest[i]);
+    hash_hex(digest, result);
+    return result;
+}
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Read 8 bytes as a little-endian integer (whatever the platform).
+*/
+static uint64_t murmur3_block(const unsigned char* p) {
+    uint64_t k = 0;
+    for(int i = 7; i >= 0; --i) {
+        k = (k << 8) | p[i];
     }
-    result[32] = 0;
+    return k;
+}
+
+/* Final mix of a 64 bits lane.
+*/
+static uint64_t murmur3_fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Return a 32 characters hash of the given string.
+ This function implements the MurmurHash3 algorithm (x64, 128 bits, seed 0) by Austin Appleby,
+ a non-cryptographic hash that is several times faster than MD5 on short strings.
+*/
+static char* hash_murmur3(char* str) {
+    const unsigned char* data = (const unsigned char*) str;
+    size_t len = strlen(str);
+    size_t blocks = len / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0, k1, k2;
+    static char result[33];
+
+    // body : 16 bytes blocks
+    for(size_t i = 0; i < blocks; ++i) {
+        k1 = murmur3_block(data + i*16);
+        k2 = murmur3_block(data + i*16 + 8);
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = ROTL64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = ROTL64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+    // tail : remaining bytes
+    const unsigned char* tail = data + blocks*16;
+    k1 = 0;
+    k2 = 0;
+    for(size_t i = len & 15; i > 8; --i) {
+        k2 ^= (uint64_t) tail[i-1] << ((i-9) * 8);
+    }
+    if((len & 15) > 8) {
+        k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for(size_t i = ((len & 15) > 8)?8:(len & 15); i > 0; --i) {
+        k1 ^= (uint64_t) tail[i-1] << ((i-1) * 8);
+    }
+    if(len & 15) {
+        k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    // finalization
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = murmur3_fmix(h1);
+    h2 = murmur3_fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    unsigned char digest[16];
+    for(int i = 0; i < 8; ++i) {
+        digest[i] = (unsigned char) (h1 >> (i*8));
+        digest[i+8] = (unsigned char) (h2 >> (i*8));
+    }
+    hash_hex(digest, result);
     return result;
-}
\ No newline at end of file
+}
+
+/* hash function of the current database (see hash_select) */
+static char* (*hash_function)(char* str) = hash_md5;
+
+/* Select the hash function used for naming element files (HASH_MD5 or HASH_MURMUR3).
+ Returns 0 if there is no such function.
+*/
+int hash_select(char* name) {
+    if(!strcmp(name, HASH_MD5)) {
+        hash_function = hash_md5;
+    }
+    else if(!strcmp(name, HASH_MURMUR3)) {
+        hash_function = hash_murmur3;
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Return a 32 characters hash of the given string, using the hash function of the current database.
+ (returned string is overwritten by next call)
+*/
+char* hash(char* str) {
+    return hash_function(str);
+}
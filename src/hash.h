@@ -4,12 +4,20 @@
     Copyright (C) Cedric Francoys, 2015, Yegen
     Some Right Reserved, GNU GPL 3 license <http://www.gnu.org/licenses/>
 */
-   
+
 #ifndef HASH_H
 #define HASH_H 1
 
-/* Generate a MD5 digest from a given string.
+/* Available hash functions (value of the 'hash' setting of a database) */
+#define HASH_MD5        "md5"       // default
+#define HASH_MURMUR3    "murmur3"
+
+/* Select the hash function used for naming element files.
+*/
+int hash_select(char* name);
+
+/* Generate a 32 characters digest from a given string.
 */
 char* hash (char* str);
 
-#endif
\ No newline at end of file
+#endif
@@ -18,113 +18,161 @@
 #include "list.h"
 
 
-/*
- Returns a pointer to the node after which given node has to be inserted.
- If an error occurs or if an equivalent node is already present, function returns NULL.
+/* Compare two nodes : by id if both have one, by string otherwise.
 */
-int list_pos(LIST* list, NODE* node, NODE** nodeptr) {
-    if(!list || !node) return -1;
-	int res = 1;
-    NODE* ptr = list->first;
-    while(ptr->next) {
-        int cmp = strcmp(ptr->next->str, node->str);
-        if(cmp == 0) {
-            // an elem by that name is already in the list
-			res = 0;
-            break;
-        }
-        if(cmp > 0) {
-            // we reached to position where the node has to be inserted
-			res = 1;
-            break;
+static int list_cmp(const NODE* node1, const NODE* node2) {
+    if(node1->id && node2->id) {
+        return (node1->id > node2->id) - (node1->id < node2->id);
+    }
+    return strcmp(node1->str, node2->str);
+}
+
+/* Compare two nodes (qsort callback).
+*/
+static int node_cmp(const void* a, const void* b) {
+    return list_cmp((const NODE*) a, (const NODE*) b);
+}
+
+/* Make room for at least given count of nodes.
+*/
+static void list_reserve(LIST* list, int count) {
+    if(count > list->size) {
+        list->size = (list->size)?list->size:64;
+        while(list->size < count) list->size *= 2;
+        list->nodes = xrealloc(list->nodes, sizeof(NODE) * list->size);
+    }
+}
+
+/* Append a node at the end of a list, without checking its position.
+ (allows to load many nodes at once : list has to be sorted with list_sort before being used,
+ unless nodes are appended in ascending order)
+ Given string (if any) now belongs to the list.
+*/
+void list_append(LIST* list, unsigned int id, char* str) {
+    list_reserve(list, list->count+1);
+    NODE node = {str, id};
+    if(list->count && list_cmp(&list->nodes[list->count-1], &node) >= 0) {
+        list->unsorted = 1;
+    }
+    list->nodes[list->count++] = node;
+}
+
+/* Sort the nodes of a list and remove duplicates (of which the one holding a string is kept).
+*/
+void list_sort(LIST* list) {
+    if(!list->unsorted) return;
+    qsort(list->nodes, list->count, sizeof(NODE), node_cmp);
+    int j = 0;
+    for(int i = 0; i < list->count; ++i) {
+        if(j && list_cmp(&list->nodes[j-1], &list->nodes[i]) == 0) {
+            if(!list->nodes[j-1].str) {
+                list->nodes[j-1].str = list->nodes[i].str;
+            }
+            else free(list->nodes[i].str);
+            continue;
         }
-        ptr = ptr->next;
+        list->nodes[j++] = list->nodes[i];
     }
-	if(nodeptr != NULL) {
-		*nodeptr = ptr;
-	}
-	return res;
+    list->count = j;
+    list->unsorted = 0;
 }
 
 /* Insert a node into a sorted list.
- (given node is ignored if a node holding an identical string is already in the list)
+ (given string is ignored if a node holding an identical string or id is already in the list)
+ Nodes coming in ascending order are appended, others are found by binary search.
  return values:
- -1 error (NULL parameter(s))
-  0 elem by that name already exists
-  1 node successfuly inserted
+ -1 error (NULL parameter)
+  0 elem by that name already exists (string still belongs to caller)
+  1 node successfuly inserted (string now belongs to the list)
 */
-int list_insert_unique(LIST* list, NODE* node) {
-    if(!list || !node) return -1;
-	// find first occurence of node string in given list
-    NODE* ptr;
-	if(!list_pos(list, node, &ptr)) {
-		// string already in the list
-		return 0;
-	}
-    // insert node at current position
-    NODE* temp = ptr->next;
-    ptr->next = node;
-    node->next = temp;
+int list_insert(LIST* list, unsigned int id, char* str) {
+    if(!list || (!id && !str)) return -1;
+    list_sort(list);
+    NODE node = {str, id};
+    int low = 0, high = list->count;
+    if(high && list_cmp(&list->nodes[high-1], &node) < 0) {
+        low = high;
+    }
+    while(low < high) {
+        int mid = low + (high-low)/2;
+        if(list_cmp(&list->nodes[mid], &node) < 0) low = mid+1;
+        else high = mid;
+    }
+    if(low < list->count && list_cmp(&list->nodes[low], &node) == 0) {
+        // an elem by that name is already in the list
+        return 0;
+    }
+    list_reserve(list, list->count+1);
+    memmove(&list->nodes[low+1], &list->nodes[low], sizeof(NODE) * (list->count-low));
+    list->nodes[low] = node;
     ++list->count;
     return 1;
 }
 
-/* Remove all entries from list1 that are not also present in list2. 
+/* Remove all entries from list1 that are not also present in list2.
+ (both lists are walked once, side by side)
 */
 int list_intersect(LIST* list1, LIST* list2) {
     if(!list1 || !list2) return -1;
-
-	NODE* ptr = list1->first;
-	while(ptr->next) {
-		if(list_pos(list2, ptr->next, NULL)) {
-			// if string is not present in list2, remove it from list1
-			NODE* temp = ptr->next;
-			ptr->next = temp->next;
-			free(temp->str);
-			free(temp);			
-			--list1->count;
-		}
-        else ptr = ptr->next;
-		if(!ptr) break;
-	}
+    list_sort(list1);
+    list_sort(list2);
+    int j = 0, k = 0;
+    for(int i = 0; i < list1->count; ++i) {
+        while(k < list2->count && list_cmp(&list2->nodes[k], &list1->nodes[i]) < 0) ++k;
+        if(k < list2->count && list_cmp(&list2->nodes[k], &list1->nodes[i]) == 0) {
+            list1->nodes[j++] = list1->nodes[i];
+        }
+        else free(list1->nodes[i].str);
+    }
+    list1->count = j;
     return 1;
 }
 
-/* Remove all entries from list1 that are present in list2. 
+/* Remove all entries from list1 that are present in list2.
+ (both lists are walked once, side by side)
 */
 int list_diff(LIST* list1, LIST* list2) {
     if(!list1 || !list2) return -1;
-
-	NODE* ptr = list2->first;
-	while(ptr->next) {
-		NODE* ptr1;
-		if(!list_pos(list1, ptr->next, &ptr1)) {
-			// if string is present in both lists, remove it from list1
-			NODE* temp = ptr1->next;
-			ptr1->next = temp->next;
-			free(temp->str);
-			free(temp);
-			--list1->count;
-		}
-        else ptr = ptr->next;
-		if(!ptr) break;
-	}	
+    list_sort(list1);
+    list_sort(list2);
+    int j = 0, k = 0;
+    for(int i = 0; i < list1->count; ++i) {
+        while(k < list2->count && list_cmp(&list2->nodes[k], &list1->nodes[i]) < 0) ++k;
+        if(k < list2->count && list_cmp(&list2->nodes[k], &list1->nodes[i]) == 0) {
+            free(list1->nodes[i].str);
+        }
+        else list1->nodes[j++] = list1->nodes[i];
+    }
+    list1->count = j;
     return 1;
 }
 
-/* Add each entry in list2 to list1.
+/* Move each entry of list2 to list1 (list2 is left empty).
+ Both lists are merged in a single pass, and strings are moved rather than copied.
 */
 int list_merge(LIST* list1, LIST* list2) {
     if(!list1 || !list2) return -1;
-
-	NODE* ptr = list2->first;
-	while(ptr->next) {
-		NODE* new = (NODE*) xzalloc(sizeof(NODE));
-		new->str = (char*) xmalloc(strlen(ptr->next->str)+1);
-		strcpy(new->str, ptr->next->str);
-		list_insert_unique(list1, new);
-		ptr = ptr->next;
-	}	
+    list_sort(list1);
+    list_sort(list2);
+    if(list2->count) {
+        int size = list1->count+list2->count;
+        NODE* nodes = xmalloc(sizeof(NODE) * size);
+        int i = 0, k = 0, j = 0;
+        while(i < list1->count || k < list2->count) {
+            int cmp = (i == list1->count)?1:(k == list2->count)?-1:list_cmp(&list1->nodes[i], &list2->nodes[k]);
+            if(cmp < 0) nodes[j++] = list1->nodes[i++];
+            else if(cmp > 0) nodes[j++] = list2->nodes[k++];
+            else {
+                // node already in list1
+                free(list2->nodes[k++].str);
+            }
+        }
+        free(list1->nodes);
+        list1->nodes = nodes;
+        list1->count = j;
+        list1->size = size;
+        list2->count = 0;
+    }
     return 1;
 }
 
@@ -133,8 +181,9 @@ int list_merge(LIST* list1, LIST* list2) {
 */
 int list_output(LIST* list){
 	if(!list) return 0;
-    for(NODE* node = list->first->next; node; node = node->next) {
-        if(!output(stdout, node->str)) {
+    list_sort(list);
+    for(int i = 0; i < list->count; ++i) {
+        if(!output(stdout, list->nodes[i].str)) {
             return 0;
         }
         printf("\n");
@@ -145,12 +194,12 @@ int list_output(LIST* list){
 /* Deallocate memory used for nodes contained in the list.
 */
 void list_free(LIST* list) {
-    NODE* node = list->first;
-    while(node) {
-        NODE* next = node->next;
-        free(node->str);
-        free(node);
-        node = next;
+    for(int i = 0; i < list->count; ++i) {
+        free(list->nodes[i].str);
     }
+    free(list->nodes);
+    list->nodes = NULL;
     list->count = 0;
+    list->size = 0;
+    list->unsorted = 0;
 }
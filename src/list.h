@@ -7,27 +7,37 @@
 
 #ifndef LIST_H
 #define LIST_H 1
-/* This file defines a linked list structure allowing to hold non-redundant and ordered array of strings
+/* This file defines a list structure allowing to hold non-redundant and ordered array of strings
+ Lists of database elements are ordered by element id (strings being only resolved for output),
+ other lists are ordered by string (id is then 0).
+ Nodes are held in a growable array (a zero-filled LIST is an empty list), so that lists are built
+ by appending nodes and then sorting them once, and set operations are single passes over both lists.
 */
 
-/* Linked list node */
+/* List node */
 struct node {
     char* str;
-    struct node *next;
+    unsigned int id;
 };
 typedef struct node NODE;
 
-/* Linked list */
+/* List (array of nodes) */
 typedef struct list {
-    NODE* first;
+    NODE* nodes;
     int count;
+    int size;           // allocated nodes
+    int unsorted;       // nodes were appended out of order (see list_sort)
 } LIST;
 
 
-int list_pos(LIST* list, NODE* node, NODE** nodeptr);
+/* Insert a node into a sorted list. */
+int list_insert(LIST* list, unsigned int id, char* str);
 
-/* Insert elem into a sorted list. */
-int list_insert_unique(LIST* list, NODE* node);
+/* Append a node at the end of a list (list has to be sorted before being used). */
+void list_append(LIST* list, unsigned int id, char* str);
+
+/* Sort the nodes of a list and remove duplicates. */
+void list_sort(LIST* list);
 
 /* Remove all entries from list1 that are not also present in list2. */
 int list_intersect(LIST* list1, LIST* list2);
@@ -35,7 +45,7 @@ int list_intersect(LIST* list1, LIST* list2);
 /* Remove all entries from list1 that are present in list2. */
 int list_diff(LIST* list1, LIST* list2);
 
-/* Add each entry in list2 to list1. */
+/* Move each entry of list2 to list1. */
 int list_merge(LIST* list1, LIST* list2);
 
 /* Print out a list of names. */
@@ -44,4 +54,4 @@ int list_output(LIST* list);
 /* Deallocate memory used for nodes contained in the list. */
 void list_free(LIST* list);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,579 @@
+/* pack.c - interface for the single-file (packed) database backend.
+
+    This file is part of the tagger program <http://www.github.com/cedricfrancoys/tagger>
+    Copyright (C) Cedric Francoys, 2015, Yegen
+    Some Right Reserved, GNU GPL 3 license <http://www.gnu.org/licenses/>
+*/
+
+/* A pack is a single file, mapped into memory, that holds all the records
+ (i.e. the files) of a database, so that a DB with millions of elements
+ does not need millions of inodes.
+
+ The file is made of:
+ - a header, holding the free-space map (list of free extents);
+ - a name catalog: an open-addressing hash table of slots pointing to records;
+ - records: a fixed-size head followed by the name of the record and its data.
+
+ Records are given some extra room when allocated, so that appending to a
+ record is most of the time done in place. When there is no room left,
+ the record is moved to a bigger block and the former block is freed.
+ All positions are stored as offsets, since the mapping address changes
+ whenever the file grows.
+
+ The pack gives no crash guarantee: its header, free-space map and catalog are
+ updated in place inside the mapping, with no journal and no ordering of the
+ writes, and the mapping is only flushed when storage is closed (see pack_sync).
+ A crash in the middle of a command can leave a slot pointing to a freed (or
+ reused) block. Databases that must survive crashes use the 'dir' backend.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "xalloc.h"
+#include "pack.h"
+
+#define PACK_MAGIC      "TAGGERDB"
+#define PACK_VERSION    1
+
+#define PACK_FREE_MAX   250     // max number of extents in the free-space map
+#define PACK_SLOTS_MIN  1024    // initial size of the catalog (must be a power of 2)
+#define PACK_CHUNK      65536   // file is grown by multiples of this size
+#define PACK_DATA_MIN   64      // minimum room for data in a new record
+#define PACK_SPLIT_MIN  64      // do not split free extents into smaller pieces
+
+#define PACK_ALIGN(n)   (((n)+7) & ~((uint64_t) 7))
+
+#define SLOT_EMPTY      0
+#define SLOT_USED       1
+#define SLOT_REMOVED    2
+
+typedef struct pack_extent {
+    uint64_t offset;
+    uint64_t size;
+} EXTENT;
+
+typedef struct pack_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t slots;         // capacity of the catalog
+    uint32_t count;         // slots in use (either used or removed)
+    uint32_t free_count;    // extents in the free-space map
+    uint64_t end;           // end of the allocated area
+    uint64_t catalog;       // offset of the catalog
+    EXTENT   free[PACK_FREE_MAX];
+} HEADER;
+
+typedef struct pack_slot {
+    uint64_t offset;        // offset of the record
+    uint32_t hash;          // hash of the record name
+    uint32_t state;
+} SLOT;
+
+typedef struct pack_record {
+    uint32_t size;          // room available for data
+    uint32_t length;        // bytes of data actually used
+    uint32_t name_len;
+    uint32_t reserved;
+} RECORD;
+
+static int    pack_fd = -1;
+static char*  pack_map = NULL;
+static size_t pack_map_size = 0;
+
+#define HEAD            ((HEADER*) pack_map)
+#define SLOTS           ((SLOT*) (pack_map + HEAD->catalog))
+#define REC(offset)     ((RECORD*) (pack_map + (offset)))
+#define REC_NAME(rec)   ((char*) (rec) + sizeof(RECORD))
+#define REC_DATA(rec)   (REC_NAME(rec) + PACK_ALIGN((rec)->name_len+1))
+#define REC_BLOCK(rec)  (sizeof(RECORD) + PACK_ALIGN((rec)->name_len+1) + (rec)->size)
+
+
+/* FNV-1a hash of a record name.
+*/
+static uint32_t pack_hash(char* name) {
+    uint32_t h = 2166136261u;
+    for(unsigned char* ptr = (unsigned char*) name; *ptr; ++ptr) {
+        h ^= *ptr;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Grow the pack file so that it is at least of given size, and map it again.
+*/
+static int pack_resize(uint64_t size) {
+    size = ((size + PACK_CHUNK - 1) / PACK_CHUNK) * PACK_CHUNK;
+    if(size < 2*pack_map_size) {
+        size = 2*pack_map_size;
+    }
+    if(ftruncate(pack_fd, size) < 0) {
+        return 0;
+    }
+    if(pack_map) {
+        munmap(pack_map, pack_map_size);
+    }
+    pack_map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, pack_fd, 0);
+    if(pack_map == MAP_FAILED) {
+        pack_map = NULL;
+        return 0;
+    }
+    pack_map_size = size;
+    return 1;
+}
+
+/* Remove an extent from the free-space map.
+*/
+static void pack_unlist(int i) {
+    HEAD->free[i] = HEAD->free[--HEAD->free_count];
+}
+
+/* Give a block back to the free-space map.
+ Adjacent extents are merged, and a block at the end of the allocated area shrinks it.
+ If the map is full, the smallest extent is dropped (its room is lost until next migration).
+*/
+static void pack_free(uint64_t offset, uint64_t size) {
+    HEADER* head = HEAD;
+    for(int i = 0; i < head->free_count; ++i) {
+        EXTENT* ext = &head->free[i];
+        if(ext->offset + ext->size == offset) {
+            offset = ext->offset;
+            size += ext->size;
+            pack_unlist(i);
+            i = -1;
+        }
+        else if(offset + size == ext->offset) {
+            size += ext->size;
+            pack_unlist(i);
+            i = -1;
+        }
+    }
+    if(offset + size == head->end) {
+        head->end = offset;
+        return;
+    }
+    if(head->free_count < PACK_FREE_MAX) {
+        head->free[head->free_count].offset = offset;
+        head->free[head->free_count].size = size;
+        ++head->free_count;
+        return;
+    }
+    int smallest = 0;
+    for(int i = 1; i < head->free_count; ++i) {
+        if(head->free[i].size < head->free[smallest].size) smallest = i;
+    }
+    if(head->free[smallest].size < size) {
+        head->free[smallest].offset = offset;
+        head->free[smallest].size = size;
+    }
+}
+
+/* Allocate a block of (at least) given size.
+ Returns the offset of the block (0 on error) and updates size with the actual size of the block.
+*/
+static uint64_t pack_alloc(uint64_t* size) {
+    uint64_t need = PACK_ALIGN(*size);
+    // first fit in free-space map
+    for(int i = 0; i < HEAD->free_count; ++i) {
+        EXTENT* ext = &HEAD->free[i];
+        if(ext->size >= need) {
+            uint64_t offset = ext->offset;
+            if(ext->size - need >= PACK_SPLIT_MIN) {
+                ext->offset += need;
+                ext->size -= need;
+            }
+            else {
+                need = ext->size;
+                pack_unlist(i);
+            }
+            *size = need;
+            return offset;
+        }
+    }
+    // append to the allocated area
+    uint64_t offset = HEAD->end;
+    if(offset + need > pack_map_size && !pack_resize(offset + need)) {
+        return 0;
+    }
+    HEAD->end += need;
+    *size = need;
+    return offset;
+}
+
+/* Find the slot of the record having given name.
+ Returns the index of the slot, or -1 if there is no such record.
+*/
+static long pack_find(char* name) {
+    uint32_t hash = pack_hash(name);
+    uint32_t mask = HEAD->slots - 1;
+    for(uint32_t i = hash & mask, n = 0; n < HEAD->slots; i = (i+1) & mask, ++n) {
+        SLOT* slot = &SLOTS[i];
+        if(slot->state == SLOT_EMPTY) break;
+        if(slot->state == SLOT_USED && slot->hash == hash && strcmp(REC_NAME(REC(slot->offset)), name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Reserve a slot for a record name (which is assumed not to be in the catalog yet).
+*/
+static long pack_insert(uint32_t hash, uint64_t offset) {
+    uint32_t mask = HEAD->slots - 1;
+    for(uint32_t i = hash & mask; ; i = (i+1) & mask) {
+        SLOT* slot = &SLOTS[i];
+        if(slot->state != SLOT_USED) {
+            if(slot->state == SLOT_EMPTY) ++HEAD->count;
+            slot->state = SLOT_USED;
+            slot->hash = hash;
+            slot->offset = offset;
+            return i;
+        }
+    }
+}
+
+/* Double the size of the catalog when it gets too crowded.
+*/
+static int pack_rehash(void) {
+    if(HEAD->count*10 < HEAD->slots*7) {
+        return 1;
+    }
+    uint64_t old_catalog = HEAD->catalog;
+    uint32_t old_slots = HEAD->slots;
+    uint64_t size = (uint64_t) old_slots * 2 * sizeof(SLOT);
+    uint64_t catalog = pack_alloc(&size);
+    if(!catalog) {
+        return 0;
+    }
+    memset(pack_map + catalog, 0, size);
+    HEAD->catalog = catalog;
+    HEAD->slots = old_slots * 2;
+    HEAD->count = 0;
+    for(uint32_t i = 0; i < old_slots; ++i) {
+        SLOT* slot = (SLOT*) (pack_map + old_catalog) + i;
+        if(slot->state == SLOT_USED) {
+            pack_insert(slot->hash, slot->offset);
+        }
+    }
+    pack_free(old_catalog, (uint64_t) old_slots * sizeof(SLOT));
+    return 1;
+}
+
+/* Allocate a new record able to hold given amount of data.
+ Returns the offset of the record, or 0 on error.
+*/
+static uint64_t pack_new_record(char* name, uint64_t room) {
+    uint32_t name_len = strlen(name);
+    if(room < PACK_DATA_MIN) room = PACK_DATA_MIN;
+    uint64_t size = sizeof(RECORD) + PACK_ALIGN(name_len+1) + room;
+    uint64_t offset = pack_alloc(&size);
+    if(!offset) {
+        return 0;
+    }
+    RECORD* rec = REC(offset);
+    rec->name_len = name_len;
+    rec->size = size - sizeof(RECORD) - PACK_ALIGN(name_len+1);
+    rec->length = 0;
+    rec->reserved = 0;
+    memcpy(REC_NAME(rec), name, name_len+1);
+    return offset;
+}
+
+/* Move the record held in given slot to a new block having room for at least given length.
+ (room is doubled so that consecutive appends are done in amortized constant time)
+*/
+static RECORD* pack_grow(long i, uint64_t length) {
+    uint64_t room = 2*length;
+    char* name = xstrdup(REC_NAME(REC(SLOTS[i].offset)));
+    uint64_t offset = pack_new_record(name, room);
+    free(name);
+    if(!offset) {
+        return NULL;
+    }
+    RECORD* old = REC(SLOTS[i].offset);
+    RECORD* rec = REC(offset);
+    memcpy(REC_DATA(rec), REC_DATA(old), old->length);
+    rec->length = old->length;
+    pack_free(SLOTS[i].offset, REC_BLOCK(old));
+    SLOTS[i].offset = offset;
+    return rec;
+}
+
+/* Create an empty record.
+ Returns the index of its slot, or -1 on error.
+*/
+static long pack_create(char* name, uint64_t room) {
+    if(!pack_rehash()) {
+        return -1;
+    }
+    uint64_t offset = pack_new_record(name, room);
+    if(!offset) {
+        return -1;
+    }
+    return pack_insert(pack_hash(name), offset);
+}
+
+
+/* Open (or create) the pack file and map it into memory.
+*/
+int pack_open(char* filename, int flag_create) {
+    if(pack_map) {
+        return 1;
+    }
+    pack_fd = open(filename, O_RDWR | (flag_create?O_CREAT:0), 0644);
+    if(pack_fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if(fstat(pack_fd, &st) < 0) {
+        pack_close();
+        return 0;
+    }
+    if(st.st_size == 0) {
+        if(!flag_create || !pack_resize(PACK_CHUNK)) {
+            pack_close();
+            return 0;
+        }
+        // initialize an empty pack
+        memcpy(HEAD->magic, PACK_MAGIC, 8);
+        HEAD->version = PACK_VERSION;
+        HEAD->end = PACK_ALIGN(sizeof(HEADER));
+        uint64_t size = PACK_SLOTS_MIN * sizeof(SLOT);
+        HEAD->catalog = pack_alloc(&size);
+        HEAD->slots = PACK_SLOTS_MIN;
+        memset(SLOTS, 0, size);
+        return 1;
+    }
+    pack_map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, pack_fd, 0);
+    if(pack_map == MAP_FAILED) {
+        pack_map = NULL;
+        pack_close();
+        return 0;
+    }
+    pack_map_size = st.st_size;
+    if(memcmp(HEAD->magic, PACK_MAGIC, 8) != 0 || HEAD->version != PACK_VERSION) {
+        // not a pack file (or unsupported version)
+        pack_close();
+        return 0;
+    }
+    return 1;
+}
+
+/* Unmap and close the pack file.
+*/
+void pack_close(void) {
+    if(pack_map) {
+        munmap(pack_map, pack_map_size);
+    }
+    if(pack_fd >= 0) {
+        close(pack_fd);
+    }
+    pack_map = NULL;
+    pack_map_size = 0;
+    pack_fd = -1;
+}
+
+/* Flush the changes made to the mapped pack file to disk.
+*/
+int pack_sync(void) {
+    if(!pack_map) {
+        return 1;
+    }
+    return (msync(pack_map, pack_map_size, MS_SYNC) == 0 && fsync(pack_fd) == 0);
+}
+
+int pack_exists(char* name) {
+    return (pack_find(name) >= 0);
+}
+
+/* Retrieve a copy of the content of a record (allocated buffer, NUL terminated).
+ Returns NULL if there is no such record.
+*/
+char* pack_read(char* name, size_t* len) {
+    long i = pack_find(name);
+    if(i < 0) {
+        return NULL;
+    }
+    RECORD* rec = REC(SLOTS[i].offset);
+    char* buf = xmalloc(rec->length+1);
+    memcpy(buf, REC_DATA(rec), rec->length);
+    buf[rec->length] = 0;
+    if(len) *len = rec->length;
+    return buf;
+}
+
+/* Retrieve the length of the content of a record (-1 if there is no such record).
+*/
+long pack_size(char* name) {
+    long i = pack_find(name);
+    if(i < 0) {
+        return -1;
+    }
+    return (long) REC(SLOTS[i].offset)->length;
+}
+
+/* Copy at most size-1 bytes from the beginning of a record (NUL terminated).
+*/
+int pack_head(char* name, char* buf, size_t size) {
+    long i = pack_find(name);
+    if(i < 0) {
+        return 0;
+    }
+    RECORD* rec = REC(SLOTS[i].offset);
+    size_t len = (rec->length < size-1)?rec->length:size-1;
+    memcpy(buf, REC_DATA(rec), len);
+    buf[len] = 0;
+    return 1;
+}
+
+/* Copy at most size bytes of a record, starting at given position.
+ Returns the number of copied bytes, or -1 if there is no such record.
+*/
+long pack_get(char* name, long pos, char* buf, size_t size) {
+    long i = pack_find(name);
+    if(i < 0) {
+        return -1;
+    }
+    RECORD* rec = REC(SLOTS[i].offset);
+    if(pos < 0 || (uint64_t) pos >= rec->length) {
+        return 0;
+    }
+    size_t len = (rec->length-pos < size)?rec->length-pos:size;
+    memcpy(buf, REC_DATA(rec)+pos, len);
+    return (long) len;
+}
+
+/* Create or replace a record.
+ An existing record is not overwritten : new content is written to a new block, which then
+ replaces the former one in the catalog (so that a reader never sees it half-written; this
+ does not hold across a crash, see above).
+*/
+int pack_write(char* name, char* buf, size_t len) {
+    long i = pack_find(name);
+    if(i < 0) {
+        if((i = pack_create(name, len)) < 0) {
+            return 0;
+        }
+        RECORD* rec = REC(SLOTS[i].offset);
+        memcpy(REC_DATA(rec), buf, len);
+        rec->length = len;
+        return 1;
+    }
+    uint64_t offset = pack_new_record(name, len);
+    if(!offset) {
+        return 0;
+    }
+    // slot of the record might have moved while remapping
+    i = pack_find(name);
+    RECORD* rec = REC(offset);
+    memcpy(REC_DATA(rec), buf, len);
+    rec->length = len;
+    uint64_t old = SLOTS[i].offset;
+    SLOTS[i].offset = offset;
+    pack_free(old, REC_BLOCK(REC(old)));
+    return 1;
+}
+
+/* Add bytes at the end of a record (record is created if it does not exist yet).
+*/
+int pack_append(char* name, char* buf, size_t len) {
+    long i = pack_find(name);
+    if(i < 0 && (i = pack_create(name, len)) < 0) {
+        return 0;
+    }
+    RECORD* rec = REC(SLOTS[i].offset);
+    if(rec->size < rec->length+len && !(rec = pack_grow(i, rec->length+len))) {
+        return 0;
+    }
+    memcpy(REC_DATA(rec)+rec->length, buf, len);
+    rec->length += len;
+    return 1;
+}
+
+/* Overwrite bytes of an existing record at given position.
+*/
+int pack_patch(char* name, long pos, char* buf, size_t len) {
+    long i = pack_find(name);
+    if(i < 0) {
+        return 0;
+    }
+    RECORD* rec = REC(SLOTS[i].offset);
+    if(rec->size < pos+len && !(rec = pack_grow(i, pos+len))) {
+        return 0;
+    }
+    memcpy(REC_DATA(rec)+pos, buf, len);
+    if(rec->length < pos+len) {
+        rec->length = pos+len;
+    }
+    return 1;
+}
+
+/* Change the name of a record.
+ As with rename(), a record already holding the target name is replaced.
+*/
+int pack_rename(char* from, char* to) {
+    long i = pack_find(from);
+    if(i < 0) {
+        return 0;
+    }
+    pack_remove(to);
+    long j = pack_create(to, REC(SLOTS[i].offset)->length);
+    if(j < 0) {
+        return 0;
+    }
+    // slot of the source record might have moved while rehashing
+    i = pack_find(from);
+    RECORD* old = REC(SLOTS[i].offset);
+    RECORD* rec = REC(SLOTS[j].offset);
+    memcpy(REC_DATA(rec), REC_DATA(old), old->length);
+    rec->length = old->length;
+    return pack_remove(from);
+}
+
+/* Remove a record and give its space back to the free-space map.
+*/
+int pack_remove(char* name) {
+    long i = pack_find(name);
+    if(i < 0) {
+        return 0;
+    }
+    pack_free(SLOTS[i].offset, REC_BLOCK(REC(SLOTS[i].offset)));
+    SLOTS[i].state = SLOT_REMOVED;
+    SLOTS[i].offset = 0;
+    return 1;
+}
+
+/* Invoke callback for each record whose name starts with given prefix.
+ Callback receives the remaining part of the name, and can alter the pack
+ (names are collected before the first call).
+ Stops as soon as callback returns 0.
+*/
+int pack_scan(char* prefix, int (*callback)(char* name, void* data), void* data) {
+    size_t prefix_len = strlen(prefix);
+    size_t count = 0;
+    char** names = xmalloc(sizeof(char*) * (HEAD->count+1));
+    for(uint32_t i = 0; i < HEAD->slots; ++i) {
+        SLOT* slot = &SLOTS[i];
+        if(slot->state != SLOT_USED) continue;
+        char* name = REC_NAME(REC(slot->offset));
+        if(strncmp(name, prefix, prefix_len) == 0) {
+            names[count++] = xstrdup(name+prefix_len);
+        }
+    }
+    int result = 1;
+    for(size_t i = 0; i < count; ++i) {
+        if(result && !callback(names[i], data)) {
+            result = 0;
+        }
+        free(names[i]);
+    }
+    free(names);
+    return result;
+}
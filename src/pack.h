@@ -0,0 +1,58 @@
+/* pack.h - interface for the single-file (packed) database backend.
+
+    This file is part of the tagger program <http://www.github.com/cedricfrancoys/tagger>
+    Copyright (C) Cedric Francoys, 2015, Yegen
+    Some Right Reserved, GNU GPL 3 license <http://www.gnu.org/licenses/>
+*/
+
+#ifndef PACK_H
+#define PACK_H 1
+
+#include <stddef.h>
+
+/* Name of the pack file, inside the install dir. */
+#define PACK_FILE       "tagger.db"
+
+/* Open (or create) the pack file and map it into memory. */
+int pack_open(char* filename, int flag_create);
+
+/* Unmap and close the pack file. */
+void pack_close(void);
+
+/* Flush the changes made to the pack file to disk. */
+int pack_sync(void);
+
+/* Check if a record by that name is present in the pack. */
+int pack_exists(char* name);
+
+/* Retrieve a copy of the content of a record. */
+char* pack_read(char* name, size_t* len);
+
+/* Retrieve the length of the content of a record. */
+long pack_size(char* name);
+
+/* Copy at most size-1 bytes from the beginning of a record. */
+int pack_head(char* name, char* buf, size_t size);
+
+/* Copy bytes of a record, starting at given position. */
+long pack_get(char* name, long pos, char* buf, size_t size);
+
+/* Create or replace a record. */
+int pack_write(char* name, char* buf, size_t len);
+
+/* Add bytes at the end of a record. */
+int pack_append(char* name, char* buf, size_t len);
+
+/* Overwrite bytes of a record at given position. */
+int pack_patch(char* name, long pos, char* buf, size_t len);
+
+/* Change the name of a record. */
+int pack_rename(char* from, char* to);
+
+/* Remove a record and give its space back to the free-space map. */
+int pack_remove(char* name);
+
+/* Invoke callback for each record whose name starts with given prefix. */
+int pack_scan(char* prefix, int (*callback)(char* name, void* data), void* data);
+
+#endif
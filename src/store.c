@@ -0,0 +1,778 @@
+/* store.c - interface for reading and writing database files.
+
+    This file is part of the tagger program <http://www.github.com/cedricfrancoys/tagger>
+    Copyright (C) Cedric Francoys, 2015, Yegen
+    Some Right Reserved, GNU GPL 3 license <http://www.gnu.org/licenses/>
+*/
+
+/* Database files are designated by a path relative to the install dir
+ (ex.: tags/0cc175b9c0f1b6a831c399e269772661).
+ Depending on the 'backend' setting of the database, they are either
+ actual files inside the install dir, or records of a pack file (see pack.c).
+
+ A file that is rewritten gets its new content written to a temporary file of its own
+ (ex.: tags/0cc175b9c0f1b6a831c399e269772661.tmpXXXXXX), which is flushed to disk and then
+ replaces the file, so that readers (and a database recovering from a crash) see either the
+ former or the new content. Appends and patches of fixed-size records are made in place,
+ and the rest of the changes are flushed to disk once, when storage is closed (see store_close).
+ With the 'dir' backend, the first change made by a command creates a journal (STORE_JOURNAL),
+ which is removed once changes are flushed: a journal found when opening the database tells that
+ a command was interrupted (the changes logged in it by the command are replayed, see
+ elem_sync_journal). A new database (storage opened for creation, ex.: when migrating) is neither
+ journaled nor flushed file by file, as it only takes the place of the former one once it is complete.
+ The pack backend gives no such guarantee (see pack.c).
+
+ Element files (the ones inside a sub-directory) of a database having the 'roots' setting are
+ partitioned among the install dir and the listed roots (ex.: one root per disk), according to the
+ leading hex digits of their name (i.e. of the element hash). Each root holds the same sub-directories
+ as the install dir, for the files of its partition only, and is dedicated to a single database.
+ Catalogs and settings always remain in the install dir.
+*/
+
+#define _GNU_SOURCE     // syncfs
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "xalloc.h"
+#include "env.h"
+#include "pack.h"
+#include "store.h"
+
+/* tells if current database uses a pack file */
+static int use_pack = 0;
+
+/* tells if files have been modified since the storage was last synced */
+static int store_dirty = 0;
+
+/* tells if storage was opened for creating a new database (see store_open) */
+static int store_fresh = 0;
+
+/* tells if a journal was left over by an interrupted command (see store_journal_read) */
+static int store_interrupted = 0;
+
+/* permissions given to new files (the ones of fopen) */
+static mode_t store_mode = 0644;
+
+/* serializes the creation of the journal (element files can be written by several threads) */
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* roots of the partitions of element files (install dir first, held as NULL) */
+static char* roots[STORE_ROOTS_MAX+1] = {NULL};
+static int roots_count = 1;
+
+
+/* Release the roots of a partitions list (install dir excepted).
+*/
+static void roots_free(char** list, int count) {
+    for(int i = 1; i < count; ++i) {
+        free(list[i]);
+    }
+}
+
+/* Split a 'roots' setting into a list of partition roots (install dir first, held as NULL).
+ Returns the count of partitions, or -1 if setting is invalid (too many roots, relative path,
+ or root listed twice).
+*/
+static int roots_split(char* setting, char** list) {
+    int count = 0;
+    list[count++] = NULL;
+    char* copy = xstrdup(setting);
+    char* saveptr;
+    for(char* root = strtok_r(copy, ":", &saveptr); root; root = strtok_r(NULL, ":", &saveptr)) {
+        for(size_t len = strlen(root); len > 1 && root[len-1] == '/'; --len) {
+            root[len-1] = 0;
+        }
+        int valid = (count <= STORE_ROOTS_MAX && root[0] == '/' && strcmp(root, get_install_dir()) != 0);
+        for(int i = 1; i < count && valid; ++i) {
+            valid = (strcmp(root, list[i]) != 0);
+        }
+        if(!valid) {
+            roots_free(list, count);
+            count = -1;
+            break;
+        }
+        list[count++] = xstrdup(root);
+    }
+    free(copy);
+    return count;
+}
+
+/* Retrieve the root of a partition (install dir for the first one).
+*/
+static char* root_path(char** list, int index) {
+    return (list[index])?list[index]:get_install_dir();
+}
+
+/* Obtain the index of the partition holding a database file, among given count of partitions.
+ Element files are named after the hash of their element (hex digits), whose leading digits
+ select the partition. Other files belong to the first partition (install dir).
+*/
+static int store_partition(char* path, int count) {
+    char* sep = strrchr(path, '/');
+    if(!sep || count <= 1) {
+        return 0;
+    }
+    char key[5] = "";
+    strncat(key, sep+1, 4);
+    return (int) (strtoul(key, NULL, 16) % count);
+}
+
+/* Obtain the full path of a database file.
+ (returned string has to be freed by caller)
+*/
+static char* store_path(char* path) {
+    char* root = root_path(roots, store_partition(path, roots_count));
+    char* full_path = xmalloc(strlen(root)+strlen(path)+2);
+    sprintf(full_path, "%s/%s", root, path);
+    return full_path;
+}
+
+/* Tell if given 'roots' setting is valid (absolute paths, at most STORE_ROOTS_MAX).
+*/
+int store_roots_check(char* setting) {
+    char* list[STORE_ROOTS_MAX+1];
+    int count = roots_split(setting, list);
+    roots_free(list, count);
+    return (count > 0);
+}
+
+/* Create the missing parent directories of a file (full path).
+ (files of a database with fan-out sub-directories are spread among directories created on demand)
+*/
+static int store_mkdirs(char* full_path) {
+    char* path = xstrdup(full_path);
+    int res = 1;
+    struct stat st;
+    for(char* sep = strchr(path+1, '/'); sep; sep = strchr(sep+1, '/')) {
+        *sep = 0;
+        if(stat(path, &st) < 0 && mkdir(path, 0755) < 0) {
+            res = 0;
+            break;
+        }
+        *sep = '/';
+    }
+    free(path);
+    errno = 0;
+    return res;
+}
+
+/* Open a file for writing, creating its parent directories if necessary.
+*/
+static FILE* store_fopen(char* full_path, char* mode) {
+    FILE* fp = fopen(full_path, mode);
+    if(fp == NULL && errno == ENOENT && store_mkdirs(full_path)) {
+        fp = fopen(full_path, mode);
+    }
+    return fp;
+}
+
+/* Flush a directory entry to disk (ex.: a file that was just created or renamed).
+*/
+static int store_sync_dir(char* full_path) {
+    char* dir_path = xstrdup(full_path);
+    char* sep = strrchr(dir_path, '/');
+    if(sep) *sep = 0;
+    int fd = open((sep)?dir_path:".", O_RDONLY);
+    int res = (fd >= 0 && fsync(fd) == 0);
+    if(fd >= 0) close(fd);
+    free(dir_path);
+    return res;
+}
+
+/* Record that files are about to be modified by the current command : the first change creates
+ the journal (flushed to disk before any file is modified, see store_sync).
+*/
+static int store_mark(void) {
+    int res = 1;
+    pthread_mutex_lock(&store_lock);
+    if(!store_dirty) {
+        if(!use_pack && !store_fresh) {
+            char* full_path = store_path(STORE_JOURNAL);
+            int fd = open(full_path, O_WRONLY|O_CREAT|O_TRUNC, store_mode);
+            res = (fd >= 0 && fsync(fd) == 0);
+            if(fd >= 0) close(fd);
+            res = res && store_sync_dir(full_path);
+            free(full_path);
+        }
+        if(res) store_dirty = 1;
+    }
+    pthread_mutex_unlock(&store_lock);
+    return res;
+}
+
+/* Open the storage of the current database, according to its backend setting.
+ If flag_create is set, storage holds a new database (see store_fresh).
+*/
+int store_open(int flag_create) {
+    use_pack = (strcmp(db_config.backend, STORE_PACK) == 0);
+    store_fresh = flag_create;
+    mode_t mask = umask(0);
+    umask(mask);
+    store_mode = 0666 & ~mask;
+    if(!use_pack && !store_dirty) {
+        // journal of an interrupted command (kept until changes are flushed again)
+        char* full_path = store_path(STORE_JOURNAL);
+        struct stat st;
+        store_interrupted = (stat(full_path, &st) == 0);
+        store_dirty = store_interrupted;
+        free(full_path);
+    }
+    // partitions apply to element files of the 'dir' backend only
+    roots_free(roots, roots_count);
+    roots_count = 1;
+    if(!use_pack && db_config.roots[0]) {
+        roots_count = roots_split(db_config.roots, roots);
+        if(roots_count < 0) {
+            roots_count = 1;
+            return 0;
+        }
+    }
+    if(use_pack) {
+        char* pack_file = store_path(PACK_FILE);
+        int res = pack_open(pack_file, flag_create);
+        free(pack_file);
+        return res;
+    }
+    return 1;
+}
+
+/* Flush all the changes made to the database files to disk, at once.
+*/
+int store_sync(void) {
+    if(!store_dirty) {
+        return 1;
+    }
+    int res = 1;
+    if(use_pack) {
+        res = pack_sync();
+    }
+    else {
+#ifdef __linux__
+        // sync the filesystems holding the database only
+        for(int i = 0; i < roots_count && res; ++i) {
+            int fd = open(root_path(roots, i), O_RDONLY);
+            // a root that does not exist yet holds no file
+            res = (fd >= 0)?(syncfs(fd) == 0):(i > 0 && errno == ENOENT);
+            if(fd >= 0) close(fd);
+        }
+#else
+        sync();
+#endif
+    }
+    if(res && !use_pack) {
+        // changes are on disk : the command is no longer in progress
+        char* full_path = store_path(STORE_JOURNAL);
+        remove(full_path);
+        free(full_path);
+        store_interrupted = 0;
+    }
+    if(res) store_dirty = 0;
+    return res;
+}
+
+/* Append records to the journal of the current command, and flush them to disk
+ (changes are logged before being applied, so that they can be replayed after a crash).
+*/
+int store_journal(char* buf, size_t len) {
+    if(!store_mark()) {
+        return 0;
+    }
+    if(use_pack || store_fresh) {
+        return 1;
+    }
+    char* full_path = store_path(STORE_JOURNAL);
+    FILE* fp = fopen(full_path, "ab");
+    free(full_path);
+    if(fp == NULL) {
+        return 0;
+    }
+    int res = (fwrite(buf, 1, len, fp) == len) && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    res = (fclose(fp) == 0) && res;
+    return res;
+}
+
+/* Read the journal left over by an interrupted command.
+ Returns an allocated buffer (empty if the command logged no change), or NULL if no command was interrupted.
+*/
+char* store_journal_read(size_t* len) {
+    if(!store_interrupted) {
+        return NULL;
+    }
+    char* full_path = store_path(STORE_JOURNAL);
+    FILE* fp = fopen(full_path, "rb");
+    free(full_path);
+    char* buf = NULL;
+    size_t n = 0, size = 0;
+    if(fp) {
+        char chunk[4096];
+        size_t got;
+        while((got = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            buf = xrealloc(buf, size = n+got+1);
+            memcpy(buf+n, chunk, got);
+            n += got;
+        }
+        fclose(fp);
+    }
+    if(!buf) buf = xzalloc(1);
+    buf[n] = 0;
+    if(len) *len = n;
+    return buf;
+}
+
+/* Release the storage of the current database (pending changes are synced first).
+*/
+void store_close(void) {
+    store_sync();
+    if(use_pack) {
+        pack_close();
+    }
+    roots_free(roots, roots_count);
+    roots_count = 1;
+}
+
+/* Tells if distinct files can be accessed from several threads at once
+ (pack file is remapped when growing, so its records must be accessed by one thread only).
+*/
+int store_concurrent(void) {
+    return !use_pack;
+}
+
+int store_exists(char* path) {
+    if(use_pack) return pack_exists(path);
+    char* full_path = store_path(path);
+    struct stat st;
+    int res = (stat(full_path, &st) == 0);
+    free(full_path);
+    return res;
+}
+
+/* Retrieve the size of a file (-1 if file does not exist).
+*/
+long store_size(char* path) {
+    if(use_pack) return pack_size(path);
+    char* full_path = store_path(path);
+    struct stat st;
+    long res = (stat(full_path, &st) == 0)?(long) st.st_size:-1;
+    free(full_path);
+    return res;
+}
+
+/* Read the whole content of a file.
+ Returns an allocated buffer (NUL terminated), or NULL if file could not be read.
+*/
+char* store_read(char* path, size_t* len) {
+    if(use_pack) return pack_read(path, len);
+    char* full_path = store_path(path);
+    FILE* fp = fopen(full_path, "rb");
+    free(full_path);
+    if(fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* buf = xmalloc(size+1);
+    size_t n = fread(buf, 1, size, fp);
+    buf[n] = 0;
+    fclose(fp);
+    if(len) *len = n;
+    return buf;
+}
+
+/* Map the whole content of a file into memory, for reading only (result is NUL terminated,
+ and has to be released with store_unmap).
+ With the dir backend, the file is mapped as it is, so that its content is neither copied nor
+ allocated : it is preceded by a reservation of zero-filled memory one byte larger, which
+ provides the terminating NUL when the size of the file is a multiple of the page size.
+ (records of a pack file are copied, as the pack file can be remapped by any write)
+*/
+char* store_map(char* path, size_t* len) {
+    if(use_pack) return pack_read(path, len);
+    char* full_path = store_path(path);
+    int fd = open(full_path, O_RDONLY);
+    free(full_path);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    char* buf = NULL;
+    if(fstat(fd, &st) == 0) {
+        size_t size = st.st_size;
+        buf = mmap(NULL, size+1, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(buf == MAP_FAILED) {
+            buf = NULL;
+        }
+        else if(size && mmap(buf, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(buf, size+1);
+            buf = NULL;
+        }
+        if(buf && len) *len = size;
+    }
+    close(fd);
+    return buf;
+}
+
+/* Release the content of a file obtained from store_map (len is the size that was given).
+*/
+void store_unmap(char* buf, size_t len) {
+    if(use_pack) free(buf);
+    else if(buf) munmap(buf, len+1);
+}
+
+/* Read at most size-1 bytes from the beginning of a file (result is NUL terminated).
+*/
+int store_head(char* path, char* buf, size_t size) {
+    if(use_pack) return pack_head(path, buf, size);
+    char* full_path = store_path(path);
+    FILE* fp = fopen(full_path, "rb");
+    free(full_path);
+    if(fp == NULL) {
+        return 0;
+    }
+    size_t n = fread(buf, 1, size-1, fp);
+    buf[n] = 0;
+    fclose(fp);
+    return 1;
+}
+
+/* Read at most size bytes of a file, starting at given position.
+ Returns the number of bytes read, or -1 if file could not be read.
+*/
+long store_get(char* path, long pos, char* buf, size_t size) {
+    if(use_pack) return pack_get(path, pos, buf, size);
+    char* full_path = store_path(path);
+    FILE* fp = fopen(full_path, "rb");
+    free(full_path);
+    if(fp == NULL) {
+        return -1;
+    }
+    long res = -1;
+    if(fseek(fp, pos, SEEK_SET) == 0) {
+        res = (long) fread(buf, 1, size, fp);
+    }
+    fclose(fp);
+    return res;
+}
+
+/* Create or replace a file.
+ Content is written to a temporary file of its own (so that concurrent commands do not share it),
+ which is flushed to disk and then renamed (replacing the file at once).
+*/
+int store_write(char* path, char* buf, size_t len) {
+    if(!store_mark()) return 0;
+    if(use_pack) return pack_write(path, buf, len);
+    char* full_path = store_path(path);
+    char* temp_path = xmalloc(strlen(full_path)+strlen(STORE_TMP)+7);
+    sprintf(temp_path, "%s%sXXXXXX", full_path, STORE_TMP);
+    int fd = mkstemp(temp_path);
+    if(fd < 0 && errno == ENOENT && store_mkdirs(full_path)) {
+        // template is undefined after a failure
+        sprintf(temp_path, "%s%sXXXXXX", full_path, STORE_TMP);
+        fd = mkstemp(temp_path);
+    }
+    int res = 0;
+    FILE* fp = (fd >= 0)?fdopen(fd, "wb"):NULL;
+    if(fp != NULL) {
+        res = (fwrite(buf, 1, len, fp) == len) && fchmod(fd, store_mode) == 0;
+        // a new database is flushed as a whole, once complete
+        res = res && (store_fresh || (fflush(fp) == 0 && fsync(fd) == 0));
+        res = (fclose(fp) == 0) && res;
+        res = res && (rename(temp_path, full_path) == 0);
+        if(!res) remove(temp_path);
+    }
+    else if(fd >= 0) {
+        close(fd);
+        remove(temp_path);
+    }
+    free(temp_path);
+    free(full_path);
+    return res;
+}
+
+/* Add bytes at the end of a file (file is created if it does not exist yet).
+*/
+int store_append(char* path, char* buf, size_t len) {
+    if(!store_mark()) return 0;
+    if(use_pack) return pack_append(path, buf, len);
+    char* full_path = store_path(path);
+    FILE* fp = store_fopen(full_path, "ab");
+    free(full_path);
+    if(fp == NULL) {
+        return 0;
+    }
+    int res = (fwrite(buf, 1, len, fp) == len);
+    fclose(fp);
+    return res;
+}
+
+/* Overwrite bytes of an existing file at given position.
+*/
+int store_patch(char* path, long pos, char* buf, size_t len) {
+    if(!store_mark()) return 0;
+    if(use_pack) return pack_patch(path, pos, buf, len);
+    char* full_path = store_path(path);
+    FILE* fp = fopen(full_path, "r+b");
+    free(full_path);
+    if(fp == NULL) {
+        return 0;
+    }
+    fseek(fp, pos, SEEK_SET);
+    int res = (fwrite(buf, 1, len, fp) == len);
+    fclose(fp);
+    return res;
+}
+
+int store_rename(char* from, char* to) {
+    if(!store_mark()) return 0;
+    if(use_pack) return pack_rename(from, to);
+    char* full_from = store_path(from);
+    char* full_to = store_path(to);
+    int res = (rename(full_from, full_to) == 0);
+    if(!res && errno == ENOENT && store_mkdirs(full_to)) {
+        res = (rename(full_from, full_to) == 0);
+    }
+    free(full_from);
+    free(full_to);
+    return res;
+}
+
+int store_remove(char* path) {
+    if(!store_mark()) return 0;
+    if(use_pack) return pack_remove(path);
+    char* full_path = store_path(path);
+    int res = (remove(full_path) == 0);
+    free(full_path);
+    return res;
+}
+
+/* Collect the names of the files inside a directory (and its sub-directories),
+ relatively to given base directory.
+*/
+static int store_list(char* base, char* sub, char*** names, size_t* count, size_t* size) {
+    char* dir_path = xmalloc(strlen(base)+strlen(sub)+2);
+    sprintf(dir_path, "%s%s%s", base, (*sub)?"/":"", sub);
+    DIR* dp = opendir(dir_path);
+    if(!dp) {
+        free(dir_path);
+        return 0;
+    }
+    struct dirent* ep;
+    while((ep = readdir(dp))) {
+        // skip current dir and parent dir
+        if(strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0) continue;
+        // skip temporary files (left over by an interrupted write)
+        if(strstr(ep->d_name, STORE_TMP)) continue;
+        char* name = xmalloc(strlen(sub)+strlen(ep->d_name)+2);
+        sprintf(name, "%s%s%s", sub, (*sub)?"/":"", ep->d_name);
+        char* full_name = xmalloc(strlen(dir_path)+strlen(ep->d_name)+2);
+        sprintf(full_name, "%s/%s", dir_path, ep->d_name);
+        struct stat st;
+        if(stat(full_name, &st) == 0 && S_ISDIR(st.st_mode)) {
+            store_list(base, name, names, count, size);
+            free(name);
+        }
+        else {
+            if(*count == *size) {
+                *size = (*size)?(*size)*2:256;
+                *names = xrealloc(*names, sizeof(char*) * (*size));
+            }
+            (*names)[(*count)++] = name;
+        }
+        free(full_name);
+    }
+    closedir(dp);
+    free(dir_path);
+    return 1;
+}
+
+/* Remove the empty sub-directories of a directory (full path).
+ Returns 1 if the directory itself is empty.
+*/
+static int store_prune_dir(char* dir_path) {
+    DIR* dp = opendir(dir_path);
+    if(!dp) {
+        return 0;
+    }
+    int empty = 1;
+    struct dirent* ep;
+    while((ep = readdir(dp))) {
+        if(strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0) continue;
+        char* full_name = xmalloc(strlen(dir_path)+strlen(ep->d_name)+2);
+        sprintf(full_name, "%s/%s", dir_path, ep->d_name);
+        struct stat st;
+        if(stat(full_name, &st) == 0 && S_ISDIR(st.st_mode) && store_prune_dir(full_name) && rmdir(full_name) == 0) {
+            // sub-directory was empty and has been removed
+        }
+        else empty = 0;
+        free(full_name);
+    }
+    closedir(dp);
+    return empty;
+}
+
+/* Remove the empty sub-directories of a directory (the directory itself is kept).
+*/
+void store_prune(char* dir) {
+    if(use_pack) return;
+    for(int i = 0; i < roots_count; ++i) {
+        char* root = root_path(roots, i);
+        char* dir_path = xmalloc(strlen(root)+strlen(dir)+2);
+        sprintf(dir_path, "%s/%s", root, dir);
+        store_prune_dir(dir_path);
+        free(dir_path);
+    }
+}
+
+/* files of a directory inside one partition, collected by a scan */
+struct scan_part {
+    char* dir_path;
+    char** names;
+    size_t count;
+    size_t size;
+    int res;
+};
+
+/* Collect the names of the files of a directory inside one partition
+ (a directory that is missing from a root other than the install dir holds no file).
+*/
+static void* scan_part_list(void* data) {
+    struct scan_part* part = data;
+    part->res = store_list(part->dir_path, "", &part->names, &part->count, &part->size);
+    if(!part->res && errno == ENOENT) {
+        part->res = -1;
+    }
+    return NULL;
+}
+
+/* Invoke callback for each file in given directory (and its sub-directories).
+ Callback receives the name of the file relatively to the directory.
+ Names are collected before the first call, so that callback can alter the directory
+ (the partitions of a database having several roots are listed in parallel).
+ Stops as soon as callback returns 0.
+*/
+int store_scan(char* dir, int (*callback)(char* name, void* data), void* data) {
+    if(use_pack) {
+        char* prefix = xmalloc(strlen(dir)+2);
+        sprintf(prefix, "%s/", dir);
+        int res = pack_scan(prefix, callback, data);
+        free(prefix);
+        return res;
+    }
+    // partitions are listed at once (one thread per root)
+    struct scan_part parts[STORE_ROOTS_MAX+1];
+    pthread_t threads[STORE_ROOTS_MAX+1];
+    int started[STORE_ROOTS_MAX+1];
+    size_t max = 0;
+    for(int i = 0; i < roots_count; ++i) {
+        char* root = root_path(roots, i);
+        parts[i] = (struct scan_part) {xmalloc(strlen(root)+strlen(dir)+2), NULL, 0, 0, 0};
+        sprintf(parts[i].dir_path, "%s/%s", root, dir);
+        started[i] = (i > 0 && pthread_create(&threads[i], NULL, scan_part_list, &parts[i]) == 0);
+    }
+    int result = 1;
+    for(int i = 0; i < roots_count; ++i) {
+        if(started[i]) pthread_join(threads[i], NULL);
+        else scan_part_list(&parts[i]);
+        // install dir has to hold the directory
+        if(parts[i].res == 0 || (i == 0 && parts[i].res < 0)) result = 0;
+        if(parts[i].count > max) max = parts[i].count;
+    }
+    // partitions are interleaved, so that consecutive files are spread among roots
+    for(size_t j = 0; j < max; ++j) {
+        for(int i = 0; i < roots_count; ++i) {
+            if(j >= parts[i].count) continue;
+            if(result && !callback(parts[i].names[j], data)) {
+                result = 0;
+            }
+            free(parts[i].names[j]);
+        }
+    }
+    for(int i = 0; i < roots_count; ++i) {
+        free(parts[i].names);
+        free(parts[i].dir_path);
+    }
+    return result;
+}
+
+/* Move a file from a root to another (copying it when roots are on distinct filesystems).
+*/
+static int store_move(char* full_from, char* full_to) {
+    if(rename(full_from, full_to) == 0 || (errno == ENOENT && store_mkdirs(full_to) && rename(full_from, full_to) == 0)) {
+        return 1;
+    }
+    if(errno != EXDEV) {
+        return 0;
+    }
+    FILE* in = fopen(full_from, "rb");
+    FILE* out = (in)?store_fopen(full_to, "wb"):NULL;
+    int res = (in && out);
+    char buf[65536];
+    size_t len;
+    while(res && (len = fread(buf, 1, sizeof(buf), in)) > 0) {
+        res = (fwrite(buf, 1, len, out) == len);
+    }
+    if(in) {
+        res = res && !ferror(in);
+        fclose(in);
+    }
+    if(out && fclose(out) != 0) {
+        res = 0;
+    }
+    return res && remove(full_from) == 0;
+}
+
+/* Move the files of a directory to the partitions they belong to with given 'roots' setting.
+ Active partitions are left unchanged: database has to be reopened once its setting is updated.
+*/
+int store_repartition(char* dir, char* setting) {
+    char* target[STORE_ROOTS_MAX+1];
+    int target_count = roots_split(setting, target);
+    if(use_pack || target_count < 0) {
+        roots_free(target, target_count);
+        return 0;
+    }
+    if(!store_mark()) {
+        roots_free(target, target_count);
+        return 0;
+    }
+    int res = 1;
+    for(int i = 0; i < roots_count && res; ++i) {
+        char* root = root_path(roots, i);
+        struct scan_part part = {xmalloc(strlen(root)+strlen(dir)+2), NULL, 0, 0, 0};
+        sprintf(part.dir_path, "%s/%s", root, dir);
+        scan_part_list(&part);
+        res = (part.res > 0 || (i > 0 && part.res < 0));
+        for(size_t j = 0; j < part.count; ++j) {
+            char* path = xmalloc(strlen(dir)+strlen(part.names[j])+2);
+            sprintf(path, "%s/%s", dir, part.names[j]);
+            char* to_root = root_path(target, store_partition(path, target_count));
+            if(res && strcmp(to_root, root) != 0) {
+                char* full_from = xmalloc(strlen(root)+strlen(path)+2);
+                char* full_to = xmalloc(strlen(to_root)+strlen(path)+2);
+                sprintf(full_from, "%s/%s", root, path);
+                sprintf(full_to, "%s/%s", to_root, path);
+                res = store_move(full_from, full_to);
+                free(full_from);
+                free(full_to);
+            }
+            free(path);
+            free(part.names[j]);
+        }
+        store_prune_dir(part.dir_path);
+        free(part.names);
+        free(part.dir_path);
+    }
+    roots_free(target, target_count);
+    return res;
+}
@@ -0,0 +1,92 @@
+/* store.h - interface for reading and writing database files.
+
+    This file is part of the tagger program <http://www.github.com/cedricfrancoys/tagger>
+    Copyright (C) Cedric Francoys, 2015, Yegen
+    Some Right Reserved, GNU GPL 3 license <http://www.gnu.org/licenses/>
+*/
+
+#ifndef STORE_H
+#define STORE_H 1
+
+#include <stddef.h>
+
+/* Available backends (value of the 'backend' setting of a database) */
+#define STORE_DIR   "dir"       // one file per element, in tags/ and files/ sub-directories
+#define STORE_PACK  "pack"      // all elements in a single memory-mapped file
+
+/* maximum count of extra roots element files can be partitioned among (see 'roots' setting) */
+#define STORE_ROOTS_MAX 16
+
+/* extension of the temporary files used for replacing files (followed by a unique suffix) */
+#define STORE_TMP   ".tmp"
+
+/* journal of the command in progress ('dir' backend), in the install dir */
+#define STORE_JOURNAL   "tagger.jnl"
+
+/* Open the storage of the current database. */
+int store_open(int flag_create);
+
+/* Flush all the changes made to the database files to disk. */
+int store_sync(void);
+
+/* Log changes in the journal of the command in progress, before applying them. */
+int store_journal(char* buf, size_t len);
+
+/* Read the journal left over by an interrupted command. */
+char* store_journal_read(size_t* len);
+
+/* Release the storage of the current database (changes are synced first). */
+void store_close(void);
+
+/* Tell if distinct files can be accessed from several threads at once. */
+int store_concurrent(void);
+
+/* Check if a file exists. */
+int store_exists(char* path);
+
+/* Retrieve the size of a file. */
+long store_size(char* path);
+
+/* Read the whole content of a file. */
+char* store_read(char* path, size_t* len);
+
+/* Map the whole content of a file into memory, for reading only. */
+char* store_map(char* path, size_t* len);
+
+/* Release the content of a file obtained from store_map. */
+void store_unmap(char* buf, size_t len);
+
+/* Read at most size-1 bytes from the beginning of a file. */
+int store_head(char* path, char* buf, size_t size);
+
+/* Read bytes of a file, starting at given position. */
+long store_get(char* path, long pos, char* buf, size_t size);
+
+/* Create or replace a file. */
+int store_write(char* path, char* buf, size_t len);
+
+/* Add bytes at the end of a file. */
+int store_append(char* path, char* buf, size_t len);
+
+/* Overwrite bytes of a file at given position. */
+int store_patch(char* path, long pos, char* buf, size_t len);
+
+/* Change the name of a file. */
+int store_rename(char* from, char* to);
+
+/* Remove a file. */
+int store_remove(char* path);
+
+/* Remove the empty sub-directories of a directory. */
+void store_prune(char* dir);
+
+/* Invoke callback for each file in given directory (and its sub-directories). */
+int store_scan(char* dir, int (*callback)(char* name, void* data), void* data);
+
+/* Tell if a 'roots' setting is valid. */
+int store_roots_check(char* setting);
+
+/* Move the files of a directory to the partitions they belong to with given 'roots' setting. */
+int store_repartition(char* dir, char* setting);
+
+#endif
@@ -40,6 +40,7 @@
 #include <getopt.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <signal.h>
 
 #include "env.h"
 #include "charset.h"
@@ -49,6 +50,7 @@
 #include "list.h"
 #include "error.h"
 #include "eval.h"
+#include "store.h"
 #include "tagger.h"
 
 /* Global flags */
@@ -89,6 +91,56 @@ char DB_NODE_SYNTAX[10] = "absolute";
 
 char DB_CHARSET[32] = "UTF-8";
 
+/* database backend
+Set with --db-backend option, applies to 'init' and 'migrate' operations only
+(other operations use the backend the database was created with).
+Possible values:
+ ""       unspecified (default)
+ "dir"    one file per element (STORE_DIR)
+ "pack"   single memory-mapped file (STORE_PACK)
+*/
+char DB_BACKEND[8] = "";
+
+/* database fan-out
+Set with --db-fanout option, applies to 'init' and 'migrate' operations only.
+Number of levels of sub-directories used for spreading element files (ex.: files/ab/cd/abcd...)
+Possible values:
+ -1       unspecified (default)
+ 0..4     levels of sub-directories (FANOUT_MAX)
+*/
+int DB_FANOUT = -1;
+
+/* database hash
+Set with --db-hash option, applies to 'init' and 'migrate' operations only.
+Function used for naming element files after their full name.
+Possible values:
+ ""         unspecified (default)
+ "md5"      MD5 digest (HASH_MD5)
+ "murmur3"  MurmurHash3, faster (HASH_MURMUR3)
+*/
+char DB_HASH[8] = "";
+
+/* database inverse relations
+Set with --db-inverse option, applies to 'init' and 'migrate' operations only.
+Way of keeping the relations of files (the ones of tags are always written at once).
+Possible values:
+ ""       unspecified (default)
+ "sync"   relations of files are written along with the ones of tags (INVERSE_SYNC)
+ "lazy"   changes of files are journaled, and applied when files relations are read (INVERSE_LAZY)
+*/
+char DB_INVERSE[8] = "";
+
+/* database roots
+Set with --db-roots option, applies to 'init' and 'migrate' operations only ('dir' backend).
+Extra directories (ex.: on distinct disks) element files are partitioned among, along with the install dir,
+according to the hash of the elements. Each root is dedicated to a single database.
+Possible values:
+ NULL           unspecified (default)
+ ""             no extra root
+ "dir1:dir2"    absolute paths separated with ':' (at most STORE_ROOTS_MAX)
+*/
+char* DB_ROOTS = NULL;
+
 
 /* trash flag
 Allows to restrict current operation to trashed elements only.
@@ -98,6 +150,23 @@ Possible values:
 */
 int trash_flag = 0;
 
+/* count flag
+Set with --counts (or --count) option.
+Possible values:
+ 0    output elements (default)
+ 1    output the count of related elements along with each element ('list'), or the count of
+      matching elements instead of the elements ('query')
+*/
+int count_flag = 0;
+
+/* interrupt flag
+Set when user asks for interruption (SIGINT, SIGTERM) during a long operation (ex.: 'clean').
+Possible values:
+ 0    keep on going (default)
+ 1    stop as soon as database is in a consistent state
+*/
+volatile sig_atomic_t interrupt_flag = 0;
+
 
 /* Non-boolean long options that have no corresponding short equivalents.  */
 enum {
@@ -106,7 +175,12 @@ enum {
   ENV_PATH_OPTION,
   ENV_DIR_OPTION,
   DB_NODE_SYNTAX_OPTION,
-  DB_CHARSET_OPTION
+  DB_CHARSET_OPTION,
+  DB_BACKEND_OPTION,
+  DB_FANOUT_OPTION,
+  DB_HASH_OPTION,
+  DB_INVERSE_OPTION,
+  DB_ROOTS_OPTION
 };
 
 /* ELEM_DIR is defined in env.c
@@ -114,6 +188,9 @@ enum {
 */
 extern const char* ELEM_DIR[];
 
+/* PATH_SEPARATOR is defined in env.c (separator of the directories in file names) */
+extern const char* PATH_SEPARATOR;
+
 
 /* Available options
 */
@@ -122,6 +199,8 @@ static struct option options[] = {
     {"debug",           0,    &verbose_flag, 2},
 
     {"trash",           0,    &trash_flag, 1},
+    {"counts",          0,    &count_flag, 1},
+    {"count",           0,    &count_flag, 1},
 
     {"mode",            1,    0, MODE_OPTION},          // default : tags
     {"files",           0,    &mode_flag, ELEM_FILE},
@@ -133,6 +212,11 @@ static struct option options[] = {
 
     {"db-node-syntax",  1,    0, DB_NODE_SYNTAX_OPTION},// default : absolute
     {"db-charset",      1,    0, DB_CHARSET_OPTION},    // default : UTF-8
+    {"db-backend",      1,    0, DB_BACKEND_OPTION},    // default : dir
+    {"db-fanout",       1,    0, DB_FANOUT_OPTION},     // default : 0
+    {"db-hash",         1,    0, DB_HASH_OPTION},       // default : md5
+    {"db-inverse",      1,    0, DB_INVERSE_OPTION},    // default : sync
+    {"db-roots",        1,    0, DB_ROOTS_OPTION},      // default : none
 
     {"help",            0,    0, 'h'},
     {"version",         0,    0, 'v'},
@@ -149,6 +233,7 @@ static struct operation operations[] = {
     {"delete",  op_delete},
     {"recover", op_recover},
     {"rename",  op_rename},
+    {"move",    op_move},
     {"merge",   op_merge},
     {"tag",     op_tag},
     {"list",    op_list},
@@ -156,6 +241,7 @@ static struct operation operations[] = {
     {"tags",    op_tags},
     {"query",   op_query},
     {"clean",   op_clean},
+    {"migrate", op_migrate},
     {0, 0}
 };
 
@@ -198,8 +284,25 @@ void usage (int status) {
                     Default '.tagger'\n\
   --local           Force using current directory for database\n\n\
   --trash           Restrict current operation to trashed elements only\n\
+  --counts          Output the count of related elements along with each element ('list')\n\
+                    or the count of matching elements ('query', alias: --count)\n\
   --db-charset=     Specify database charset (default is UTF-8)\n\
-  --db-node-syntax= Define how filenames are stored (relative or absolute path)\n\n\
+  --db-node-syntax= Define how filenames are stored (relative or absolute path)\n\
+  --db-backend=     Define how database is stored (at 'init' or 'migrate' time)\n\
+                    Possible values: 'dir'|'pack'\n\
+                    Default: 'dir'\n\
+  --db-fanout=      Levels of sub-directories for element files (at 'init' or 'migrate' time)\n\
+                    Possible values: 0 to 4\n\
+                    Default: 0\n\
+  --db-hash=        Function used for naming element files (at 'init' or 'migrate' time)\n\
+                    Possible values: 'md5'|'murmur3' (faster)\n\
+                    Default: 'md5'\n\
+  --db-inverse=     How relations of files are kept (at 'init' or 'migrate' time)\n\
+                    Possible values: 'sync'|'lazy' (derived from tags, faster tagging)\n\
+                    Default: 'sync'\n\
+  --db-roots=       Extra directories element files are partitioned among, separated with ':'\n\
+                    (at 'init' or 'migrate' time, 'dir' backend only)\n\
+                    Default: none\n\n\
   --quiet           Suppress all normal output\n\
   --debug           Output program trace and internal errors\n\
   --help            Display this help text\n\
@@ -212,12 +315,15 @@ void usage (int status) {
   delete        Delete one or more element(s) (all relations will be lost)\n\
   recover       Recover a previously deleted element\n\
   rename        Rename an element\n\
+  move          Change the path of the files of a moved directory (ex.: tagger --files move OLD NEW)\n\
   merge         Merge two elements (existing relations will be applied to both)\n\
   tag           Add(+) or remove(-) tag(s) to/from one or more files\n\
   list          Show all elements in database for specified mode\n\
   query         Retrieve all elements matching given criteria (depends on mode)\n\
   tags          Shorthand for \"tagger --tags list\"\n\
-  files         Shorthand for \"tagger --files list\""
+  files         Shorthand for \"tagger --files list\"\n\
+  clean         Purge trash and compact database files\n\
+  migrate       Convert database to the settings given as options (ex.: --db-backend, --db-fanout, --db-hash, --db-inverse, --db-roots)"
         );
         puts("Examples:\n\
   tagger create mp3 music\n\
@@ -230,15 +336,54 @@ void usage (int status) {
     }
 }
 
-/* Remove deleted items from DB files (info will no longer remain in trash)
+/* Request interruption of current operation.
+*/
+static void interrupt(int sig) {
+    interrupt_flag = 1;
+}
+
+/* Remove deleted items from DB files (info will no longer remain in trash):
+ trashed elements are purged, and relations logs are folded without removed relations.
+ Can be safely interrupted (files are processed one at a time, and catalogs are kept up to date).
 */
 void op_clean(int argc, char* argv[], int index) {
-    // todo
+    CLEAN_STATS stats = {0, 0, 0, 0, 0};
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+    trace(TRACE_DEBUG, "cleaning tags");
+    if(!type_clean(ELEM_TAG, &stats) || (!interrupt_flag && !type_clean(ELEM_FILE, &stats))) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to clean database", __FILE__, __LINE__);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if(interrupt_flag) {
+        trace(TRACE_NORMAL, "Cleaning interrupted (%ld of %ld files processed).", stats.done, stats.total);
+    }
+    trace(TRACE_NORMAL, "%ld element(s) compacted, %ld trashed element(s) purged, %ld byte(s) reclaimed.", stats.compacted, stats.purged, stats.reclaimed);
 }
 
 void op_init(int argc, char* argv[], int index) {
     // check for application environment
     if(!check_env()) {
+        if(DB_BACKEND[0]) {
+            strcpy(db_config.backend, DB_BACKEND);
+        }
+        if(DB_FANOUT >= 0) {
+            db_config.fanout = DB_FANOUT;
+        }
+        if(DB_HASH[0]) {
+            strcpy(db_config.hash, DB_HASH);
+        }
+        if(DB_INVERSE[0]) {
+            strcpy(db_config.inverse, DB_INVERSE);
+        }
+        if(DB_ROOTS) {
+            strcpy(db_config.roots, DB_ROOTS);
+        }
+        if(db_config.roots[0] && !strcmp(db_config.backend, STORE_PACK)) {
+            raise_error(ERROR_USAGE, "Extra roots apply to the '%s' backend only.", STORE_DIR);
+        }
+        strcpy(db_config.relations, RELATIONS_IDS);
         if(!setup_env()) {
             raise_error(ERROR_ENV, "Unable to set up environment");
         }
@@ -250,6 +395,143 @@ void op_init(int argc, char* argv[], int index) {
     }
 }
 
+/* Convert the database to the settings given as options (ex.: tagger --db-backend=pack migrate).
+ All elements (trashed ones included) are exported to a temporary file, then imported into
+ a new database which takes the place of the former one (kept aside as a backup).
+ If only the fan-out changes, element files are moved in place instead
+ (a change of hash function renames all element files, hence a full conversion).
+ A change of the inverse setting is applied in place as well (pending changes of files are applied first),
+ and so is a change of the roots setting (element files are moved to their new partition).
+ A full conversion gathers the element files into the install dir first, and spreads them among
+ the roots once the new database took its place.
+ Databases created by former versions (relations stored by name) are converted as well.
+*/
+void op_migrate(int argc, char* argv[], int index) {
+    CONFIG target = db_config;
+    if(DB_BACKEND[0]) {
+        strcpy(target.backend, DB_BACKEND);
+    }
+    if(DB_FANOUT >= 0) {
+        target.fanout = DB_FANOUT;
+    }
+    if(DB_HASH[0]) {
+        strcpy(target.hash, DB_HASH);
+    }
+    if(DB_INVERSE[0]) {
+        strcpy(target.inverse, DB_INVERSE);
+    }
+    if(DB_ROOTS) {
+        strcpy(target.roots, DB_ROOTS);
+    }
+    if(target.roots[0] && !strcmp(target.backend, STORE_PACK)) {
+        raise_error(ERROR_USAGE, "Extra roots apply to the '%s' backend only.", STORE_DIR);
+    }
+    // databases created by former versions are converted to relations by id
+    strcpy(target.relations, RELATIONS_IDS);
+    if(!strcmp(target.backend, db_config.backend) && !strcmp(target.relations, db_config.relations)
+       && !strcmp(target.hash, db_config.hash)) {
+        if(target.fanout == db_config.fanout && !strcmp(target.inverse, db_config.inverse)
+           && !strcmp(target.roots, db_config.roots)) {
+            trace(TRACE_NORMAL, "Database already matches given settings: nothing to do.");
+            return;
+        }
+        if(strcmp(target.inverse, db_config.inverse) != 0 && !elem_sync_inverse()) {
+            raise_error(ERROR_ENV, "%s:%d - Unable to update relations of files", __FILE__, __LINE__);
+        }
+        if(target.fanout != db_config.fanout) {
+            // only fan-out changes : move element files in place
+            trace(TRACE_DEBUG, "moving element files to %d level(s) of sub-directories", target.fanout);
+            if(!type_relocate(ELEM_TAG, target.fanout) || !type_relocate(ELEM_FILE, target.fanout)) {
+                raise_error(ERROR_ENV, "%s:%d - Unable to move element files", __FILE__, __LINE__);
+            }
+        }
+        if(strcmp(target.roots, db_config.roots) != 0) {
+            // only partitions change : move element files to their new root
+            trace(TRACE_DEBUG, "moving element files to roots '%s'", target.roots);
+            if(!store_repartition((char*) ELEM_DIR[ELEM_TAG], target.roots)
+               || !store_repartition((char*) ELEM_DIR[ELEM_FILE], target.roots)) {
+                raise_error(ERROR_ENV, "%s:%d - Unable to move element files", __FILE__, __LINE__);
+            }
+        }
+        db_config = target;
+        // storage is reopened with the new partitions
+        if(!write_config(&db_config) || !store_open(0)) {
+            raise_error(ERROR_ENV, "%s:%d - Unable to save database settings", __FILE__, __LINE__);
+        }
+        trace(TRACE_NORMAL, "Database successfully converted (%d level(s) of sub-directories, '%s' relations of files).", target.fanout, target.inverse);
+        return;
+    }
+    char* install_dir = xstrdup(get_install_dir());
+    char* new_dir = xmalloc(strlen(install_dir)+strlen(".migrate")+1);
+    char* backup_dir = xmalloc(strlen(install_dir)+strlen(".bak")+1);
+    sprintf(new_dir, "%s.migrate", install_dir);
+    sprintf(backup_dir, "%s.bak", install_dir);
+    DIR* dp;
+    if((dp = opendir(new_dir)) || (dp = opendir(backup_dir))) {
+        closedir(dp);
+        raise_error(ERROR_USAGE, "Directory '%s' or '%s' already exists: remove it first.", new_dir, backup_dir);
+    }
+
+    // 0) gather element files into the install dir (which is kept aside as a whole)
+    if(db_config.roots[0]) {
+        trace(TRACE_DEBUG, "moving element files back to '%s'", install_dir);
+        if(!store_repartition((char*) ELEM_DIR[ELEM_TAG], "") || !store_repartition((char*) ELEM_DIR[ELEM_FILE], "")) {
+            raise_error(ERROR_ENV, "%s:%d - Unable to move element files", __FILE__, __LINE__);
+        }
+        db_config.roots[0] = 0;
+        if(!write_config(&db_config) || !store_open(0)) {
+            raise_error(ERROR_ENV, "%s:%d - Unable to save database settings", __FILE__, __LINE__);
+        }
+    }
+
+    // 1) export current database
+    FILE* stream = tmpfile();
+    if(!stream) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to create temporary file", __FILE__, __LINE__);
+    }
+    trace(TRACE_DEBUG, "exporting database '%s'", install_dir);
+    if(!elem_export(ELEM_TAG, stream) || !elem_export(ELEM_FILE, stream)) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to export database", __FILE__, __LINE__);
+    }
+    store_close();
+
+    // 2) import into a new database
+    trace(TRACE_DEBUG, "importing into database '%s'", new_dir);
+    set_install_dir(new_dir);
+    db_config = target;
+    db_config.roots[0] = 0;
+    if(!setup_env()) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to set up database '%s'", __FILE__, __LINE__, new_dir);
+    }
+    rewind(stream);
+    int count = elem_import(stream);
+    fclose(stream);
+    store_close();
+    if(count < 0) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to import database into '%s'", __FILE__, __LINE__, new_dir);
+    }
+
+    // 3) swap databases
+    if(rename(install_dir, backup_dir) < 0 || rename(new_dir, install_dir) < 0) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to replace database '%s' with '%s'", __FILE__, __LINE__, install_dir, new_dir);
+    }
+    set_install_dir(install_dir);
+
+    // 4) spread element files among the roots
+    if(target.roots[0]) {
+        trace(TRACE_DEBUG, "moving element files to roots '%s'", target.roots);
+        if(!store_open(0) || !store_repartition((char*) ELEM_DIR[ELEM_TAG], target.roots)
+           || !store_repartition((char*) ELEM_DIR[ELEM_FILE], target.roots)) {
+            raise_error(ERROR_ENV, "%s:%d - Unable to move element files", __FILE__, __LINE__);
+        }
+        db_config = target;
+        if(!write_config(&db_config) || !store_open(0)) {
+            raise_error(ERROR_ENV, "%s:%d - Unable to save database settings", __FILE__, __LINE__);
+        }
+    }
+    trace(TRACE_NORMAL, "%d element(s) successfully migrated (previous database kept in '%s').", count, backup_dir);
+}
+
 /* Create one or more tags.
  Already existing tags are ignored.
  Output the numbers of created tags and ignored tags.
@@ -334,12 +616,12 @@ void op_clone(int argc, char* argv[], int index){
 }
 
 /* Destroy one or more element(s).
- Any existing relations are removed as well.
+ Elements are moved to the trash, and their relations are no longer listed (related elements are
+ left unchanged: relations to deleted elements are dropped when cleaning the database).
 */
 void op_delete(int argc, char* argv[], int index){
     int elems_i = 0, err_i = 0;
 	LIST* list = (LIST*) xzalloc(sizeof(LIST));
-	list->first = (NODE*) xzalloc(sizeof(NODE));
 
     // first pass : build a list with all elements to be deleted
     for(int i = index; i < argc; ++i) {
@@ -351,150 +633,91 @@ void op_delete(int argc, char* argv[], int index){
             ELEM elem;
             if(elem_init(mode_flag, argv[i], &elem, 0) <= 0) {
                 raise_error(ERROR_RECOVERABLE, "%s '%s' not found", (mode_flag==ELEM_TAG)?"Tag":"File", argv[i]);
+                ++err_i;
                 continue;
             }
-            NODE* node = xmalloc(sizeof(NODE));
-            node->str = xmalloc(strlen(argv[i])+1);
-            strcpy(node->str, argv[i]);
-            list_insert_unique(list, node);
+            char* str = xstrdup(elem.name);
+            if(list_insert(list, elem.id, str) != 1) {
+                free(str);
+            }
         }
     }
     // second pass : remove all elements in the list
-    NODE* ptr = list->first;
-    while(ptr->next) {
+    list_sort(list);
+    for(int j = 0; j < list->count; ++j) {
         ELEM elem;
-        if(elem_init(mode_flag, ptr->next->str, &elem, 0) <= 0) {
-            raise_error(ERROR_RECOVERABLE, "%s '%s' not found", (mode_flag==ELEM_TAG)?"Tag":"File", ptr->next->str);
+        if(elem_open(mode_flag, list->nodes[j].str, &elem, 0) <= 0) {
+            raise_error(ERROR_RECOVERABLE, "%s '%s' not found", (mode_flag==ELEM_TAG)?"Tag":"File", list->nodes[j].str);
             ++err_i;
             continue;
 		}
 		else ++elems_i;
-        // open the element's file
-        FILE* fp = fopen(elem.file, "r");
-        char elem_name[ELEM_NAME_MAX];
-        // read/skip first line
-        if(fgets(elem_name, ELEM_NAME_MAX, fp) == NULL) {
-            // unable to read from file
-            raise_error(ERROR_ENV,
-                        "%s:%d - Couldn't open '%s' for reading",
-                        __FILE__, __LINE__, elem.file);
-        }
-        else {
-            // for each pointed file element
-            while(fgets(elem_name, ELEM_NAME_MAX, fp)) {
-                // remove the newline char
-                elem_name[strlen(elem_name)-1] = 0;
-                ELEM el_related;
-                elem_init((mode_flag%2)+1, elem_name+1, &el_related, 0);
-                // remove relation with the element being deleted
-                elem_relate(ELEM_REM, &el_related, &elem);
-            }
-        }
-        fclose(fp);
         // deleted element's file
-        //if(unlink(elem.file) < 0) {
         // instead of unlinking, we rename the file by appending a ".trash" to it
-        char newname[ELEM_NAME_MAX];
-        sprintf(newname, "%s.trash", elem.file);
-        if(rename(elem.file, newname) < 0) {
+        if(!elem_trash(&elem)) {
             // unable to delete file
             raise_error(ERROR_ENV,
                         "%s:%d - Couldn't delete file '%s'",
                         __FILE__, __LINE__, elem.file);
         }
-        ptr = ptr->next;
     }
     list_free(list);
     trace(TRACE_NORMAL, "%d %s(s) successfuly deleted, %d %s(s) ignored.", elems_i, (mode_flag==ELEM_TAG)?"tag":"file", err_i, (mode_flag==ELEM_TAG)?"tag":"file");
 }
 
 /* Recover previously deleted element(s).
- Any formerly existing relations are recovered as well.
+ Any formerly existing relations are recovered as well (they were left unchanged by deletion).
 */
 void op_recover(int argc, char* argv[], int index){
     int elems_i = 0, err_i = 0;
 	LIST* list = (LIST*) xzalloc(sizeof(LIST));
-	list->first = (NODE*) xzalloc(sizeof(NODE));
 
     // first pass : build a list with all elements to be recovered
     for(int i = index; i < argc; ++i) {
         if(strchr(argv[i], '*') != NULL) {
-            // given name contains wildcard : handle with globbing
-            glob_retrieve_list(GLOB_DB, mode_flag, argv[i], list);
+            // given name contains wildcard : handle with globbing (among trashed elements)
+            int temp_flag = trash_flag;
+            trash_flag = 1;
+            LIST* trashed = (LIST*) xzalloc(sizeof(LIST));
+            glob_retrieve_list(GLOB_DB, mode_flag, argv[i], trashed);
+            trash_flag = temp_flag;
+            // trashed elements are recovered by name (names are moved to the list)
+            for(int j = 0; j < trashed->count; ++j) {
+                if(list_insert(list, 0, trashed->nodes[j].str) == 1) {
+                    trashed->nodes[j].str = NULL;
+                }
+            }
+            list_free(trashed);
+            free(trashed);
         }
         else {
-            NODE* node = xmalloc(sizeof(NODE));
-            node->str = xmalloc(strlen(argv[i])+1);
-            strcpy(node->str, argv[i]);
-            list_insert_unique(list, node);
+            char* str = xstrdup(argv[i]);
+            if(list_insert(list, 0, str) != 1) {
+                free(str);
+            }
         }
     }
     // second pass : try to restore all elements in the list
-    NODE* ptr = list->first;
-    while(ptr->next) {
-        char* elem_name = ptr->next->str;
-        char* elem_file = resolve_name(mode_flag, elem_name);
-        char elem_trash[ELEM_NAME_MAX];
-        sprintf(elem_trash, "%s.trash", elem_file);
-        if(check_file(elem_name, elem_trash) <= 0){
+    for(int j = 0; j < list->count; ++j) {
+        char* elem_name = list->nodes[j].str;
+        ELEM elem;
+        int res = elem_recover(mode_flag, elem_name, &elem);
+        if(res == 0) {
             // unable to find trash file
-            raise_error(ERROR_RECOVERABLE, "File '%s' not found", elem_trash);
+            raise_error(ERROR_RECOVERABLE, "%s '%s' not found in trash", (mode_flag==ELEM_TAG)?"Tag":"File", elem_name);
+            ++err_i;
+        }
+        else if(res < 0) {
+            // unable to restore file
+            raise_error(ERROR_RECOVERABLE, "Unable to restore %s '%s'", (mode_flag==ELEM_TAG)?"tag":"file", elem_name);
             trace(TRACE_DEBUG,
-                        "%s:%d - Couldn't locate file '%s' for %s '%s'",
-                        __FILE__, __LINE__, elem_trash, (mode_flag==ELEM_TAG)?"tag":"file", elem_name);
-
+                        "%s:%d - Couldn't restore file '%s'",
+                        __FILE__, __LINE__, elem.file);
             ++err_i;
         }
         else {
-            // restore file
-            if(rename(elem_trash, elem_file) < 0) {
-                // unable to restore file
-                raise_error(ERROR_RECOVERABLE, "Unable to rename '%s' to '%s'", elem_trash, elem_file);
-                trace(TRACE_DEBUG,
-                            "%s:%d - Couldn't restore file '%s'",
-                            __FILE__, __LINE__, elem_file);
-                ++err_i;
-            }
-            else {
-                ELEM elem;
-                elem_init(mode_flag, elem_name, &elem, 0);
-                // open the element's file
-                FILE* fp = fopen(elem.file, "r");
-                if(!fp) {
-                    raise_error(ERROR_RECOVERABLE, "File '%s' not found", elem.file);
-                    trace(TRACE_DEBUG,
-                                "%s:%d - Couldn't open '%s' for reading",
-                                __FILE__, __LINE__, elem.file);
-                }
-                else {
-                    char line[ELEM_NAME_MAX];
-                    // read/skip first line
-                    if(fgets(line, ELEM_NAME_MAX, fp) == NULL) {
-                        // unable to read from file
-                        raise_error(ERROR_RECOVERABLE, "Error reading file '%s'", elem.file);
-                        trace(TRACE_DEBUG,
-                                    "%s:%d - Couldn't read from '%s'",
-                                    __FILE__, __LINE__, elem.file);
-                        ++err_i;
-                    }
-                    else {
-                        // for each pointed element
-                        while(fgets(line, ELEM_NAME_MAX, fp)) {
-                            // remove the newline char
-                            line[strlen(line)-1] = 0;
-                            ELEM el_related;
-                            elem_init((mode_flag%2)+1, line+1, &el_related, 0);
-                            // remove relation with the element being deleted
-                            elem_relate(ELEM_ADD, &el_related, &elem);
-                        }
-                        ++elems_i;
-                    }
-                    fclose(fp);
-                }
-            }
+            ++elems_i;
         }
-        free(elem_file);
-        ptr = ptr->next;
     }
     list_free(list);
     trace(TRACE_NORMAL, "%d %s(s) successfuly recovered, %d %s(s) ignored.", elems_i, (mode_flag==ELEM_TAG)?"tag":"file", err_i, (mode_flag==ELEM_TAG)?"tag":"file");
@@ -509,7 +732,6 @@ void op_merge(int argc, char* argv[], int index){
     if( (index+1) >= argc) trace(TRACE_NORMAL, "Nothing to do.");
     else {
     	LIST* list = (LIST*) xzalloc(sizeof(LIST));
-    	list->first = (NODE*) xzalloc(sizeof(NODE));
         // create an array of files from all given elements
         for(int i = index; i < argc; ++i) {
             ELEM elem;
@@ -520,15 +742,17 @@ void op_merge(int argc, char* argv[], int index){
 							__FILE__, __LINE__, elem.file);
             }
         }
-        // update relations with resulting array
+        // update relations with resulting array (changes are applied at once)
+        list_sort(list);
+        BATCH* batch = batch_new();
         for(int i = index; i < argc; ++i) {
             ELEM elem;
             elem_init(mode_flag, argv[i], &elem, 0);
             // (re)add current element to each element in the list
-            for(NODE* node = list->first->next; node; node = node->next) {
+            for(int j = 0; j < list->count; ++j) {
                 ELEM el_related;
-                elem_init((mode_flag%2)+1, node->str, &el_related, 0);
-                if( elem_relate(ELEM_ADD, &el_related, &elem) < 0 ) {
+                if( elem_get((mode_flag%2)+1, list->nodes[j].id, &el_related) <= 0 ) continue;
+                if( batch_relate(batch, ELEM_ADD, &el_related, &elem) < 0 ) {
                     raise_error(ERROR_ENV,
 								"%s:%d - Unexpected error while adding tag %s to file %s",
 								__FILE__, __LINE__, elem.name, el_related.name);
@@ -536,6 +760,12 @@ void op_merge(int argc, char* argv[], int index){
             }
             ++elems_i;
         }
+        if( batch_commit(batch) > 0 ) {
+            raise_error(ERROR_ENV,
+                        "%s:%d - Unexpected error while updating relations of merged %s",
+                        __FILE__, __LINE__, (mode_flag==ELEM_TAG)?"tags":"files");
+        }
+        batch_free(batch);
         list_free(list);
         trace(TRACE_NORMAL, "%d %s successfuly merged.", elems_i, (mode_flag==ELEM_TAG)?"tags":"files");
     }
@@ -587,6 +817,73 @@ void op_rename(int argc, char* argv[], int index){
     trace(TRACE_NORMAL, "1 %s successfuly renamed.", (mode_flag==ELEM_TAG)?"tag":"file");
 }
 
+/* Resolve a path given to 'move' (the former path of moved files may no longer exist :
+ it is then resolved from its parent directory, or taken as is when absolute).
+ (returned string has to be freed by caller)
+*/
+static char* move_path(char* name) {
+    char* path = get_path(name);
+    if(path) {
+        return xstrdup(path);
+    }
+    char* copy = fix_path(xstrdup(name));
+    char* base = strrchr(copy, PATH_SEPARATOR[0]);
+    char* parent = ".";
+    if(base) {
+        *base++ = 0;
+        parent = (copy[0])?copy:(char*) PATH_SEPARATOR;
+    }
+    else base = copy;
+    if(base[0] && strcmp(base, ".") && strcmp(base, "..") && (path = get_path(parent))) {
+        size_t len = strlen(path);
+        char* result = xmalloc(len+strlen(base)+2);
+        if(!len) strcpy(result, base);
+        else sprintf(result, "%s%s%s", path, (path[len-1] == PATH_SEPARATOR[0])?"":PATH_SEPARATOR, base);
+        free(copy);
+        return result;
+    }
+    free(copy);
+    if(name[0] == PATH_SEPARATOR[0] && !strcmp(DB_NODE_SYNTAX, "absolute")) {
+        return fix_path(xstrdup(name));
+    }
+    raise_error(ERROR_USAGE, "Path '%s' not found.", name);
+    return NULL;
+}
+
+/* Tell if a path is another path, or one of its sub-directories.
+*/
+static int path_within(char* path, char* dir) {
+    size_t len = strlen(dir);
+    return strncmp(path, dir, len) == 0 && (path[len] == 0 || path[len] == PATH_SEPARATOR[0]);
+}
+
+/* Change the path of all the files whose path starts with given path (ex.: files of a moved directory),
+ replacing that path with the new one. Relations are kept as they are (elements keep their id).
+ Output the numbers of moved files and ignored files (new path already in use).
+*/
+void op_move(int argc, char* argv[], int index){
+    if( (argc-index) != 2) {
+        usage(1);
+        raise_error(ERROR_USAGE, "Wrong number of arguments.");
+    }
+    if(mode_flag != ELEM_FILE) {
+        raise_error(ERROR_USAGE, "Operation 'move' applies to files only (use 'rename' for tags).");
+    }
+    char* from = move_path(argv[index]);
+    char* to = move_path(argv[index+1]);
+    if(path_within(from, to) || path_within(to, from)) {
+        raise_error(ERROR_USAGE, "Paths '%s' and '%s' must not contain each other.", from, to);
+    }
+    int ignored = 0;
+    int moved = type_move(ELEM_FILE, from, to, &ignored);
+    if(moved < 0) {
+        raise_error(ERROR_ENV, "%s:%d - Unable to move files from '%s' to '%s'", __FILE__, __LINE__, from, to);
+    }
+    free(from);
+    free(to);
+    trace(TRACE_NORMAL, "%d file(s) successfuly moved, %d file(s) ignored.", moved, ignored);
+}
+
 /* Add one or more tag(s) to onbe or more file(s).
 */
 void op_tag(int argc, char* argv[], int index){
@@ -611,7 +908,30 @@ void op_tag(int argc, char* argv[], int index){
         }
     }
 
-    // 2) apply changes to each file
+    if(files_i <= 0) {
+        trace(TRACE_NORMAL, "Nothing to do.");
+        return;
+    }
+
+    // 2) retrieve tags once (tags to add are created if they do not exist yet)
+    // (at least one slot each: zero-length arrays are not allowed)
+    ELEM el_add[add_i?add_i:1], el_rem[rem_i?rem_i:1];
+    for(int j = 0; j < add_i; ++j) {
+        int res = 0;
+        if( (res = elem_init(ELEM_TAG, add_tags[j], &el_add[j], 1)) <= 0 ) {
+            raise_error(ERROR_ENV,
+                        "%s:%d - Unexpected error occured when creating file '%s' for tag '%s'",
+                        __FILE__, __LINE__, el_add[j].file, el_add[j].name);
+        }
+        else if(res == 2) tags_i++;
+    }
+    for(int j = 0; j < rem_i; ++j) {
+        // tags that do not exist are ignored
+        if(elem_init(ELEM_TAG, rem_tags[j], &el_rem[j], 0) <= 0) el_rem[j].id = 0;
+    }
+
+    // 3) collect changes for each file, then apply them with a single write of each element file
+    BATCH* batch = batch_new();
     for(int i = 0; i < files_i; ++i) {
         ELEM el_file;
         if( elem_init(ELEM_FILE, files[i], &el_file, 1) <= 0 ) {
@@ -621,47 +941,27 @@ void op_tag(int argc, char* argv[], int index){
             continue;
         }
         for(int j = 0; j < add_i; ++j) {
-            ELEM el_tag;
-            // create tag if it does not exist yet
-            int res = 0;
-            if( (res = elem_init(ELEM_TAG, add_tags[j], &el_tag, 1)) <= 0 ) {
-		        raise_error(ERROR_ENV,
-		        			"%s:%d - Unexpected error occured when creating file '%s' for tag '%s'",
-		        			__FILE__, __LINE__, el_tag.file, el_tag.name);
-
-            }
-            else if(res == 2) tags_i++;
             // add tag to file elem & file to tag elem
-            if( elem_relate(ELEM_ADD, &el_file, &el_tag) < 0 ) {
-                raise_error(ERROR_ENV,
-                            "%s:%d - Unexpected error while adding tag '%s' to file '%s'",
-                            __FILE__, __LINE__, el_tag.name, el_file.name);
-            }
+            batch_relate(batch, ELEM_ADD, &el_file, &el_add[j]);
         }
         for(int j = 0; j < rem_i; ++j) {
-            ELEM el_tag;
-            // if tag exists, remove it from file
-            if(elem_init(ELEM_TAG, rem_tags[j], &el_tag, 0) > 0) {
-                // remove tag from file elem & file from tag elem
-                if( elem_relate(ELEM_REM, &el_file, &el_tag) < 0 ) {
-                    raise_error(ERROR_ENV,
-                                "%s:%d - Unexpected error while removing tag '%s' from file '%s'",
-                                __FILE__, __LINE__, el_tag.name, el_file.name);
-                }
-            }
+            // remove tag from file elem & file from tag elem
+            if(el_rem[j].id) batch_relate(batch, ELEM_REM, &el_file, &el_rem[j]);
         }
     }
-    if(files_i <= 0) trace(TRACE_NORMAL, "Nothing to do.");
-    else {
-        if(tags_i > 0)	trace(TRACE_NORMAL, "%d tag(s) created.", tags_i);
-        if(add_i > 0)	trace(TRACE_NORMAL, "%d tag(s) added to %d files(s).", add_i, files_i);
-        if(rem_i > 0)	trace(TRACE_NORMAL, "%d tag(s) removed from %d files(s).", rem_i, files_i);
+    if( batch_commit(batch) > 0 ) {
+        raise_error(ERROR_ENV,
+                    "%s:%d - Unexpected error while updating relations of tagged files",
+                    __FILE__, __LINE__);
     }
+    batch_free(batch);
+    if(tags_i > 0)	trace(TRACE_NORMAL, "%d tag(s) created.", tags_i);
+    if(add_i > 0)	trace(TRACE_NORMAL, "%d tag(s) added to %d files(s).", add_i, files_i);
+    if(rem_i > 0)	trace(TRACE_NORMAL, "%d tag(s) removed from %d files(s).", rem_i, files_i);
 }
 
 void op_list(int argc, char* argv[], int index) {
 	LIST* list = (LIST*) xzalloc(sizeof(LIST));
-	list->first = (NODE*) xzalloc(sizeof(NODE));
 
     // argument may be used as mask for limiting resulting list (ex. tagger --files list "C:\test\*")
     // this allows to check a single element or to retrieve all nodes inside a given directory
@@ -678,10 +978,7 @@ void op_list(int argc, char* argv[], int index) {
             // check if given element is present in DB
             ELEM elem;
             if( elem_init(mode_flag, argv[index], &elem, 0) > 0) {
-                NODE* node = xmalloc(sizeof(NODE));
-                node->str = xmalloc(strlen(elem.name)+1);
-                strcpy(node->str, elem.name);
-                list_insert_unique(list, node);
+                list_append(list, elem.id, xstrdup(elem.name));
             }
         }
     }
@@ -693,7 +990,13 @@ void op_list(int argc, char* argv[], int index) {
                         __FILE__, __LINE__, (mode_flag==ELEM_TAG)?"tags":"files");
         }
     }
-    // output resulting list
+    // output resulting list (names are followed by the counts of related elements, if requested)
+    if(count_flag && !elem_count_list(mode_flag, list)) {
+        raise_error(ERROR_ENV,
+                    "%s:%d - Unable to read relations counts of %s",
+                    __FILE__, __LINE__, (mode_flag==ELEM_TAG)?"tags":"files");
+    }
+    elem_resolve_list(mode_flag, list);
     if(!list->count) {
         if(index < argc) {
             trace(TRACE_NORMAL, "No %s with given name in database.", (mode_flag==ELEM_TAG)?"tag":"file");
@@ -735,6 +1038,18 @@ void op_query(int argc, char* argv[], int index) {
     if(index >= argc) {
         op_list(argc, argv, index);
     }
+    else if(count_flag && index+1 == argc && strchr(argv[index], '*') == NULL && (mode_flag == ELEM_TAG || !is_query(argv[index]))) {
+        // count of the elements related to a single element : read from the relations counts
+        ELEM elem;
+        int res = elem_init((mode_flag%2)+1, argv[index], &elem, 0);
+        long count = (res > 0)?elem_count(&elem):0;
+        if(res < 0 || count < 0) {
+            raise_error(ERROR_ENV,
+                        "%s:%d - Unexpected error occured while counting elements related to '%s'",
+                        __FILE__, __LINE__, argv[index]);
+        }
+        printf("%ld\n", count);
+    }
     else {
         // from now on we should have received criteria (list of tags names)
 
@@ -745,7 +1060,6 @@ void op_query(int argc, char* argv[], int index) {
         sprintf(elems_dir, "%s/%s", install_dir, ELEM_DIR[mode_flag]);
 
         LIST* list_elems = (LIST*) xzalloc(sizeof(LIST));
-        list_elems->first = (NODE*) xzalloc(sizeof(NODE));
 
 		// use arguments to build resulting list
         for(int i = index; i < argc; ++i) {
@@ -758,7 +1072,6 @@ void op_query(int argc, char* argv[], int index) {
                 if(strchr(argv[i], '*') != NULL) {
                     // given name contains wildcard : handle with globbing
                     LIST* list_related = (LIST*) xzalloc(sizeof(LIST));
-                    list_related->first = (NODE*) xzalloc(sizeof(NODE));
                     // retrieve all elements pointed by wildcard
                     // (we force DB globbing instead of FS globbing by using type ELEM_TAG)
                     if(!glob_retrieve_list(GLOB_DB, (mode_flag%2)+1, argv[i], list_related)) {
@@ -806,8 +1119,12 @@ void op_query(int argc, char* argv[], int index) {
                 list_free(list_query);
 			}
         }
-        // output resulting files list
-        if(!list_elems->count) {
+        // output resulting files list (or its count)
+        elem_resolve_list(mode_flag, list_elems);
+        if(count_flag) {
+            printf("%d\n", list_elems->count);
+        }
+        else if(!list_elems->count) {
             if(mode_flag==ELEM_TAG) trace(TRACE_NORMAL, "No tag currently applied on given file(s).");
             else                    trace(TRACE_NORMAL, "No file currently tagged with given tag(s).");
         }
@@ -888,6 +1205,45 @@ int main(int argc, char* argv[]) {
                         else if(!strcasecmp(optarg, "absolute")) strcpy(DB_NODE_SYNTAX, "absolute");
                     }
                     break;
+                case DB_BACKEND_OPTION:
+                    if (optarg) {
+                        if(!strcasecmp(optarg, STORE_DIR)) strcpy(DB_BACKEND, STORE_DIR);
+                        else if(!strcasecmp(optarg, STORE_PACK)) strcpy(DB_BACKEND, STORE_PACK);
+                        else raise_error(ERROR_USAGE, "Invalid value '%s' for option --db-backend ('%s' or '%s' expected).", optarg, STORE_DIR, STORE_PACK);
+                    }
+                    break;
+                case DB_FANOUT_OPTION:
+                    if (optarg) {
+                        char* end;
+                        long fanout = strtol(optarg, &end, 10);
+                        if(end == optarg || *end || fanout < 0 || fanout > FANOUT_MAX) {
+                            raise_error(ERROR_USAGE, "Invalid value '%s' for option --db-fanout (0 to %d expected).", optarg, FANOUT_MAX);
+                        }
+                        DB_FANOUT = (int) fanout;
+                    }
+                    break;
+                case DB_HASH_OPTION:
+                    if (optarg) {
+                        if(!strcasecmp(optarg, HASH_MD5)) strcpy(DB_HASH, HASH_MD5);
+                        else if(!strcasecmp(optarg, HASH_MURMUR3)) strcpy(DB_HASH, HASH_MURMUR3);
+                        else raise_error(ERROR_USAGE, "Invalid value '%s' for option --db-hash ('%s' or '%s' expected).", optarg, HASH_MD5, HASH_MURMUR3);
+                    }
+                    break;
+                case DB_INVERSE_OPTION:
+                    if (optarg) {
+                        if(!strcasecmp(optarg, INVERSE_SYNC)) strcpy(DB_INVERSE, INVERSE_SYNC);
+                        else if(!strcasecmp(optarg, INVERSE_LAZY)) strcpy(DB_INVERSE, INVERSE_LAZY);
+                        else raise_error(ERROR_USAGE, "Invalid value '%s' for option --db-inverse ('%s' or '%s' expected).", optarg, INVERSE_SYNC, INVERSE_LAZY);
+                    }
+                    break;
+                case DB_ROOTS_OPTION:
+                    if (optarg) {
+                        if(strlen(optarg) >= sizeof(db_config.roots) || !store_roots_check(optarg)) {
+                            raise_error(ERROR_USAGE, "Invalid value '%s' for option --db-roots (at most %d distinct absolute paths, other than the install dir, separated with ':' expected).", optarg, STORE_ROOTS_MAX);
+                        }
+                        DB_ROOTS = optarg;
+                    }
+                    break;
                 case DB_CHARSET_OPTION:
                     // todo
                     break;
@@ -919,8 +1275,19 @@ int main(int argc, char* argv[]) {
                 if(!check_env() && strcmp(operations[i].name, "init") ) {
                     raise_error(ERROR_USAGE, "Installation directory not found or corrupted... Try 'tagger init'");
                 }
+                if(db_config.version > DB_VERSION && strcmp(operations[i].name, "init")) {
+                    raise_error(ERROR_USAGE, "Database was created by a newer version of tagger (format %d).", db_config.version);
+                }
+                if(!strcmp(db_config.relations, RELATIONS_NAMES) && strcmp(operations[i].name, "init") && strcmp(operations[i].name, "migrate")) {
+                    raise_error(ERROR_USAGE, "Database format is outdated... Try 'tagger migrate'");
+                }
+                if(strcmp(operations[i].name, "init") && !elem_sync_journal()) {
+                    raise_error(ERROR_ENV, "%s:%d - Unable to recover from an interrupted command", __FILE__, __LINE__);
+                }
                 // dispatch actions and arguments processing to invoked operation
                 operations[i].f(argc, argv, arg_i+1);
+                // changes are flushed to disk once per command
+                store_close();
                 return EXIT_SUCCESS;
             }
         }
@@ -928,7 +1295,20 @@ int main(int argc, char* argv[]) {
         // if next arg starts with a + or -, relay to 'tag' op.
         if(argv[arg_i][0] == '+' || argv[arg_i][0] == '-') {
             trace(TRACE_DEBUG, "assuming shorthand syntax for operation 'tag'");
+            if(!check_env()) {
+                raise_error(ERROR_USAGE, "Installation directory not found or corrupted... Try 'tagger init'");
+            }
+            if(db_config.version > DB_VERSION) {
+                raise_error(ERROR_USAGE, "Database was created by a newer version of tagger (format %d).", db_config.version);
+            }
+            if(!strcmp(db_config.relations, RELATIONS_NAMES)) {
+                raise_error(ERROR_USAGE, "Database format is outdated... Try 'tagger migrate'");
+            }
+            if(!elem_sync_journal()) {
+                raise_error(ERROR_ENV, "%s:%d - Unable to recover from an interrupted command", __FILE__, __LINE__);
+            }
             op_tag(argc, argv, arg_i);
+            store_close();
         }
         else {
             usage(1);
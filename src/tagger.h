@@ -34,6 +34,9 @@ struct operation {
 /* Set up tagger database. */
 void op_init(int argc, char* argv[], int index);
 
+/* Convert tagger database to new settings. */
+void op_migrate(int argc, char* argv[], int index);
+
 /* Create a new empty tag. */
 void op_create(int argc, char* argv[], int index);
 
@@ -49,6 +52,9 @@ void op_recover(int argc, char* argv[], int index);
 /* Change the name of specified tag to given name. */
 void op_rename(int argc, char* argv[], int index);
 
+/* Change the path of the files of a moved directory. */
+void op_move(int argc, char* argv[], int index);
+
 /* Merge two tags. */
 void op_merge(int argc, char* argv[], int index);
 